@@ -1,72 +1,58 @@
 #include "api.h"
+#include "apicache.h"
+#include "client.h"
 #include "http.h"
+#include "metrics.h"
 #include "types.h"
-#include "server.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
 #include <string>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <unistd.h>
 
-const std::string host = std::getenv("MAL_HOST");
+const std::string host = std::getenv("MAL_HOST") ? std::getenv("MAL_HOST") : "";
 
+// cached responses are revalidated with their ETag/Last-Modified, a 304 is
+// answered from disk without transferring the body again
 HttpObject malRequest(const HttpObject& request) {
-  std::string url = createRequest(host, request);
-  
-  struct addrinfo hints{}, *serverInfo;
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = SOCK_STREAM;
-
-  if (getaddrinfo(host.c_str(), "80", &hints, &serverInfo) != 0) {
-    std::cerr << "Failed to resolve host\n";
-    throw std::runtime_error("Failed to resolve host");
+  bool cacheable = isResponseCacheEnabled() && (request.methodStr.empty() || request.methodStr == "GET");
+  if (!cacheable) {
+    return parseResponse(sendHttpRequest(host, createRequest(host, request)));
   }
 
-  int sock = socket(serverInfo->ai_family, serverInfo->ai_socktype, serverInfo->ai_protocol);
-  if (sock == -1) {
-    std::cerr << "Failed to create socket\n";
-    freeaddrinfo(serverInfo);
-    throw std::runtime_error("Failed to create socket");
+  std::string key = normalizeRequestKey(host, request);
+  CachedResponse cached;
+  bool isCached = findCachedResponse(key, cached);
+  if (isResponseCacheOffline()) {
+    if (!isCached) {
+      std::cerr << "[api.cpp:malRequest] offline and not cached: " << key << "\n";
+      throw std::runtime_error("Response not cached");
+    }
+    recordCacheLookup(CacheKind::API_RESPONSE, true);
+    return parseResponse(renderCachedResponse(cached));
   }
 
-  if (connect(sock, serverInfo->ai_addr, serverInfo->ai_addrlen) == -1) {
-    std::cerr << "Failed to connect\n";
-    close(sock);
-    freeaddrinfo(serverInfo);
-    throw std::runtime_error("Failed to connect");
+  HttpObject conditional = request;
+  if (isCached && !cached.etag.empty()) {
+    conditional.headers["If-None-Match"] = cached.etag;
   }
-
-  std::string apiRequest = "GET " + request.path;
-  if (!request.queryParams.empty()) {
-    apiRequest += "?";
-    bool first = true;
-    for (const auto& [key, value] : request.queryParams) {
-      if (!first) apiRequest += "&";
-      apiRequest += urlEncode(key) + "=" + urlEncode(value);
-      first = false;
-    }
+  if (isCached && !cached.lastModified.empty()) {
+    conditional.headers["If-Modified-Since"] = cached.lastModified;
   }
 
-  apiRequest += " HTTP/1.1\r\n";
-  apiRequest += "Host: " + host + "\r\n";
-  apiRequest += "Connection: close\r\n\r\n";
-
-  if (send(sock, apiRequest.c_str(), apiRequest.size(), 0) == -1) {
-    std::cerr << "Failed to send request\n";
-    close(sock);
-    freeaddrinfo(serverInfo);
-    throw std::runtime_error("Failed to send request");
+  std::string raw = sendHttpRequest(host, createRequest(host, conditional));
+  HttpObject response = parseResponse(raw);
+  bool revalidated = response.status == NOT_MODIFIED && isCached;
+  recordCacheLookup(CacheKind::API_RESPONSE, revalidated);
+  if (revalidated) {
+    return parseResponse(renderCachedResponse(cached));
   }
-
-  std::string response = readFromSocket(sock);
-
-  close(sock);
-  freeaddrinfo(serverInfo);
-
-  auto parsedRespone = parseResponse(response);
-  
-  return parsedRespone;
+  if (response.status == OK) {
+    CachedResponse fresh;
+    fresh.body = getResponseBody(raw);
+    fresh.etag = findHeader(response.headers, "ETag");
+    fresh.lastModified = findHeader(response.headers, "Last-Modified");
+    storeCachedResponse(key, fresh);
+  }
+  return response;
 }
-
@@ -0,0 +1,240 @@
+#include "apicache.h"
+#include "http.h"
+#include "types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// <dir>/index/<sha256 of key> holds the key, the validators and the hash of the body,
+// <dir>/objects/<2 hex>/<sha256 of body> holds the compressed body so identical
+// payloads fetched through different URLs are stored once
+constexpr char objectMagic[4] = { 'A', 'N', 'C', '1' };
+constexpr size_t objectHeaderSize = sizeof(objectMagic) + sizeof(uint64_t);
+constexpr size_t maxMappedObjects = 256;
+
+std::string cacheDirectory;
+bool cacheOffline = false;
+std::atomic<uint64_t> cacheTmpCounter(0);
+
+// recently read objects stay mapped, they never change once written
+struct MappedObject {
+  const unsigned char* data = nullptr;
+  size_t size = 0;
+
+  ~MappedObject() {
+    if (data) munmap(const_cast<unsigned char*>(data), size);
+  }
+};
+
+std::mutex mappedMtx;
+std::list<std::string> mappedOrder; // most recently used first
+std::unordered_map<std::string, std::pair<std::shared_ptr<MappedObject>, std::list<std::string>::iterator>> mappedObjects;
+
+void configureResponseCache(const std::string& directory, bool offline) {
+  cacheDirectory = directory;
+  cacheOffline = offline;
+  if (cacheDirectory.empty()) return;
+
+  std::error_code error;
+  std::filesystem::create_directories(cacheDirectory + "/index", error);
+  std::filesystem::create_directories(cacheDirectory + "/objects", error);
+  if (error) {
+    std::cerr << "[apicache.cpp:configureResponseCache] " << cacheDirectory << ": " << error.message() << "\n";
+  }
+}
+
+bool isResponseCacheEnabled() {
+  return !cacheDirectory.empty();
+}
+
+bool isResponseCacheOffline() {
+  return cacheOffline;
+}
+
+std::string sha256Hex(const std::string& data) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int length = 0;
+  if (EVP_Digest(data.data(), data.size(), digest, &length, EVP_sha256(), nullptr) != 1) {
+    throw std::runtime_error("Failed to hash cache key");
+  }
+  static const char hex[] = "0123456789abcdef";
+  std::string result;
+  result.reserve(length * 2);
+  for (unsigned int i = 0; i < length; i++) {
+    result.push_back(hex[digest[i] >> 4]);
+    result.push_back(hex[digest[i] & 15]);
+  }
+  return result;
+}
+
+std::string normalizeRequestKey(const std::string& host, const HttpObject& request) {
+  std::string key = request.methodStr.empty() ? "GET" : request.methodStr;
+  key += " ";
+  for (char c : host) {
+    key.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+  }
+  key += request.path.empty() ? "/" : request.path;
+  // queryParams is ordered, so the same parameters always give the same key
+  char separator = '?';
+  for (const auto& [name, value] : request.queryParams) {
+    key += separator + urlEncode(name) + "=" + urlEncode(value);
+    separator = '&';
+  }
+  return key;
+}
+
+std::string indexPath(const std::string& key) {
+  return cacheDirectory + "/index/" + sha256Hex(key);
+}
+
+std::string objectPath(const std::string& hash) {
+  return cacheDirectory + "/objects/" + hash.substr(0, 2) + "/" + hash;
+}
+
+// written next to the target and renamed so readers never see a partial file
+bool writeAtomically(const std::string& path, const std::string& data) {
+  std::string tmp = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(cacheTmpCounter++);
+  {
+    std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), data.size())) return false;
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<MappedObject> mapObject(const std::string& hash) {
+  {
+    std::lock_guard<std::mutex> lock(mappedMtx);
+    auto it = mappedObjects.find(hash);
+    if (it != mappedObjects.end()) {
+      mappedOrder.splice(mappedOrder.begin(), mappedOrder, it->second.second);
+      return it->second.first;
+    }
+  }
+
+  int fd = open(objectPath(hash).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < objectHeaderSize) {
+    close(fd);
+    return nullptr;
+  }
+  void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return nullptr;
+
+  auto object = std::make_shared<MappedObject>();
+  object->data = static_cast<const unsigned char*>(data);
+  object->size = info.st_size;
+
+  std::lock_guard<std::mutex> lock(mappedMtx);
+  auto it = mappedObjects.find(hash);
+  if (it != mappedObjects.end()) return it->second.first;
+  mappedOrder.push_front(hash);
+  mappedObjects.emplace(hash, std::make_pair(object, mappedOrder.begin()));
+  if (mappedObjects.size() > maxMappedObjects) {
+    mappedObjects.erase(mappedOrder.back());
+    mappedOrder.pop_back();
+  }
+  return object;
+}
+
+bool findCachedResponse(const std::string& key, CachedResponse& cached) {
+  if (cacheDirectory.empty()) return false;
+
+  std::ifstream index(indexPath(key));
+  std::string storedKey, hash;
+  if (!index || !std::getline(index, storedKey) || storedKey != key ||
+      !std::getline(index, cached.etag) || !std::getline(index, cached.lastModified) ||
+      !std::getline(index, hash) || hash.size() != 64) return false;
+
+  auto object = mapObject(hash);
+  if (!object || std::memcmp(object->data, objectMagic, sizeof(objectMagic)) != 0) {
+    std::cerr << "[apicache.cpp:findCachedResponse] missing or corrupt object " << hash << "\n";
+    return false;
+  }
+  uint64_t rawSize;
+  std::memcpy(&rawSize, object->data + sizeof(objectMagic), sizeof(rawSize));
+
+  cached.body.resize(rawSize);
+  if (rawSize == 0) return true;
+  uLongf length = rawSize;
+  int status = uncompress(
+    reinterpret_cast<Bytef*>(&cached.body[0]), &length,
+    object->data + objectHeaderSize, object->size - objectHeaderSize
+  );
+  if (status != Z_OK || length != rawSize) {
+    std::cerr << "[apicache.cpp:findCachedResponse] failed to inflate object " << hash << "\n";
+    return false;
+  }
+  return true;
+}
+
+void storeCachedResponse(const std::string& key, const CachedResponse& cached) {
+  if (cacheDirectory.empty()) return;
+
+  std::string hash = sha256Hex(cached.body);
+  std::string path = objectPath(hash);
+  if (access(path.c_str(), F_OK) != 0) {
+    uLongf length = compressBound(cached.body.size());
+    std::string object(objectHeaderSize + length, '\0');
+    uint64_t rawSize = cached.body.size();
+    std::memcpy(&object[0], objectMagic, sizeof(objectMagic));
+    std::memcpy(&object[sizeof(objectMagic)], &rawSize, sizeof(rawSize));
+    int status = compress2(
+      reinterpret_cast<Bytef*>(&object[objectHeaderSize]), &length,
+      reinterpret_cast<const Bytef*>(cached.body.data()), cached.body.size(), Z_DEFAULT_COMPRESSION
+    );
+    if (status != Z_OK) {
+      std::cerr << "[apicache.cpp:storeCachedResponse] failed to compress " << key << "\n";
+      return;
+    }
+    object.resize(objectHeaderSize + length);
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory + "/objects/" + hash.substr(0, 2), error);
+    if (!writeAtomically(path, object)) {
+      std::cerr << "[apicache.cpp:storeCachedResponse] failed to write object for " << key << "\n";
+      return;
+    }
+  }
+
+  std::string index = key + "\n" + cached.etag + "\n" + cached.lastModified + "\n" + hash + "\n";
+  if (!writeAtomically(indexPath(key), index)) {
+    std::cerr << "[apicache.cpp:storeCachedResponse] failed to write index for " << key << "\n";
+  }
+}
+
+std::string renderCachedResponse(const CachedResponse& cached) {
+  std::string response = "HTTP/1.1 200 OK\r\n";
+  response += "Content-Length: " + std::to_string(cached.body.size()) + "\r\n";
+  if (!cached.etag.empty()) {
+    response += "ETag: " + cached.etag + "\r\n";
+  }
+  if (!cached.lastModified.empty()) {
+    response += "Last-Modified: " + cached.lastModified + "\r\n";
+  }
+  return response + "\r\n" + cached.body;
+}
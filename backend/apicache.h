@@ -0,0 +1,26 @@
+#ifndef APICACHE_H
+#define APICACHE_H
+
+#include "types.h"
+
+#include <string>
+
+struct CachedResponse {
+  std::string body;
+  std::string etag;
+  std::string lastModified;
+};
+
+// on-disk cache of upstream responses, disabled until configured with a directory,
+// offline mode answers only from the cache and never touches the network
+void configureResponseCache(const std::string&, bool);
+bool isResponseCacheEnabled();
+bool isResponseCacheOffline();
+
+std::string normalizeRequestKey(const std::string&, const HttpObject&);
+bool findCachedResponse(const std::string&, CachedResponse&);
+void storeCachedResponse(const std::string&, const CachedResponse&);
+// raw 200 response carrying the cached body, as sendHttpRequest would return it
+std::string renderCachedResponse(const CachedResponse&);
+
+#endif // APICACHE_H
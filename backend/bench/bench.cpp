@@ -0,0 +1,112 @@
+#include "bench.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_FIXTURES_DIR
+#define BENCH_FIXTURES_DIR "bench/fixtures"
+#endif
+
+std::string fixturesDir = BENCH_FIXTURES_DIR;
+std::chrono::nanoseconds minTime = std::chrono::milliseconds(500);
+std::string benchFilter;
+std::atomic<size_t> resultSink(0);
+
+// plain counters, each thread only touches its own
+thread_local uint64_t allocatedBlocks = 0;
+thread_local uint64_t allocatedBytes = 0;
+
+void* operator new(std::size_t size) {
+  allocatedBlocks++;
+  allocatedBytes += size;
+  if (void* block = std::malloc(size ? size : 1)) return block;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept {
+  std::free(block);
+}
+
+void operator delete(void* block, std::size_t) noexcept {
+  std::free(block);
+}
+
+AllocationCount threadAllocations() {
+  return { allocatedBlocks, allocatedBytes };
+}
+
+std::chrono::nanoseconds benchMinTime() {
+  return minTime;
+}
+
+bool benchSelected(const std::string& name) {
+  return benchFilter.empty() || name.find(benchFilter) != std::string::npos;
+}
+
+void printBenchResult(const BenchResult& result) {
+  char line[512];
+  std::snprintf(line, sizeof(line),
+    "{\"benchmark\":\"%s\",\"fixture\":\"%s\",\"threads\":%zu,\"iterations\":%zu,"
+    "\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}",
+    result.name.c_str(), result.fixture.c_str(), result.threads, result.iterations,
+    result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+  std::cout << line << std::endl;
+}
+
+void consumeResult(size_t value) {
+  resultSink.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::string readFixture(const std::string& name) {
+  std::ifstream file(fixturesDir + "/" + name, std::ios::binary);
+  if (!file) {
+    std::cerr << "[bench.cpp:readFixture] cannot open " << fixturesDir << "/" << name << "\n";
+    throw std::runtime_error("readFixture failed");
+  }
+  std::ostringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+std::vector<std::string> readFixtureLines(const std::string& name) {
+  std::istringstream stream(readFixture(name));
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (!line.empty()) lines.push_back(line);
+  }
+  return lines;
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--fixtures" && i + 1 < argc) {
+      fixturesDir = argv[++i];
+    } else if (arg == "--min-time-ms" && i + 1 < argc) {
+      minTime = std::chrono::milliseconds(std::stoul(argv[++i]));
+    } else if (arg == "--filter" && i + 1 < argc) {
+      benchFilter = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--fixtures dir] [--min-time-ms 500] [--filter name]\n";
+      return 1;
+    }
+  }
+
+  try {
+    benchParsing();
+    benchSecurity();
+  } catch (const std::exception& e) {
+    std::cerr << "[bench.cpp:main] " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// one JSON line per result on stdout so runs of two releases can be diffed,
+// allocations are counted by the replaced global operator new of the calling thread
+struct BenchResult {
+  std::string name;
+  std::string fixture;
+  size_t threads = 1;
+  size_t iterations = 0;
+  double nsPerOp = 0;
+  double allocsPerOp = 0;
+  double bytesPerOp = 0;
+};
+
+struct AllocationCount {
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+};
+
+AllocationCount threadAllocations();
+std::chrono::nanoseconds benchMinTime();
+bool benchSelected(const std::string&);
+void printBenchResult(const BenchResult&);
+void consumeResult(size_t); // keeps results from being optimized away
+
+// file under the fixtures directory, split per line or per "### name" block
+std::string readFixture(const std::string&);
+std::vector<std::string> readFixtureLines(const std::string&);
+
+// runs op(i) in growing rounds until a round lasts benchMinTime, or exactly
+// iterations times when given, and reports the last round
+template <typename Op>
+void runBench(const std::string& name, const std::string& fixture, Op op, size_t iterations = 0) {
+  if (!benchSelected(name)) return;
+  size_t rounds = iterations ? iterations : 1;
+  while (true) {
+    size_t sink = 0;
+    AllocationCount before = threadAllocations();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+      sink += op(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    AllocationCount after = threadAllocations();
+    consumeResult(sink);
+
+    if (iterations || elapsed >= benchMinTime() || rounds >= 1000000000) {
+      BenchResult result;
+      result.name = name;
+      result.fixture = fixture;
+      result.iterations = rounds;
+      result.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+      result.allocsPerOp = static_cast<double>(after.allocs - before.allocs) / rounds;
+      result.bytesPerOp = static_cast<double>(after.bytes - before.bytes) / rounds;
+      printBenchResult(result);
+      return;
+    }
+    double perOp = std::chrono::duration<double, std::nano>(elapsed).count() / rounds;
+    double predicted = perOp > 0 ? 1.2 * benchMinTime().count() / perOp : rounds * 100.0;
+    rounds = std::max(rounds * 2, static_cast<size_t>(std::min(predicted, 1e9)));
+  }
+}
+
+void benchParsing();
+void benchSecurity();
+
+#endif // BENCH_H
@@ -0,0 +1,111 @@
+#include "bench.h"
+#include "security.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// token minting and checking, signing is also run on every core at once as
+// during a login storm
+
+using SignFunction = std::function<std::string(const std::string&, const std::string&, const std::string&, std::chrono::system_clock::time_point, int)>;
+
+const std::string benchTokenId = "Jy0zkI3v1Q9rL2f8bX4hWg";
+const std::vector<std::string> benchUsernames = { "user", "naruto_fan/1999", "quote\"and\\slash", "\xc3\xa9t\xc3\xa9" };
+const std::string benchPassword = "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08"; // clients send a hex digest
+constexpr size_t signIterations = 200000;
+constexpr size_t coldTokenCount = 20000;
+
+bool checkCompatibility() {
+  auto issuedAt = std::chrono::system_clock::now();
+  for (const auto& username : benchUsernames) {
+    std::string fast = signJwt("127.0.0.1", username, benchTokenId, issuedAt, 3600);
+    std::string reference = signJwtWithBuilder("127.0.0.1", username, benchTokenId, issuedAt, 3600);
+    if (fast != reference) {
+      std::cerr << "[crypto.cpp:checkCompatibility] tokens differ for " << username << "\n"
+                << "  signJwt            " << fast << "\n"
+                << "  signJwtWithBuilder " << reference << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+void benchSigningThreads(const std::string& name, const SignFunction& sign, size_t threads) {
+  if (!benchSelected(name)) return;
+  std::vector<AllocationCount> allocations(threads);
+  std::vector<size_t> lengths(threads);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      AllocationCount before = threadAllocations();
+      auto issuedAt = std::chrono::system_clock::now();
+      for (size_t i = t; i < signIterations; i += threads) {
+        lengths[t] += sign("127.0.0.1", benchUsernames[i % benchUsernames.size()], benchTokenId, issuedAt, 3600).size();
+      }
+      AllocationCount after = threadAllocations();
+      allocations[t] = { after.allocs - before.allocs, after.bytes - before.bytes };
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  BenchResult result;
+  result.name = name;
+  result.fixture = "usernames";
+  result.threads = threads;
+  result.iterations = signIterations;
+  result.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / signIterations;
+  for (size_t t = 0; t < threads; t++) {
+    result.allocsPerOp += static_cast<double>(allocations[t].allocs) / signIterations;
+    result.bytesPerOp += static_cast<double>(allocations[t].bytes) / signIterations;
+    consumeResult(lengths[t]);
+  }
+  printBenchResult(result);
+}
+
+void benchSecurity() {
+  setenv("JWT_ISSUER", "anidle", 0);
+  setJwtKey(createJwtKey(32));
+  if (!checkCompatibility()) throw std::runtime_error("signJwt and signJwtWithBuilder disagree");
+
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<size_t> threadCounts = { 1 };
+  if (threads > 1) threadCounts.push_back(threads);
+  for (size_t count : threadCounts) {
+    benchSigningThreads("signJwtWithBuilder", signJwtWithBuilder, count);
+    benchSigningThreads("signJwt", signJwt, count);
+  }
+
+  runBench("createJwt", "usernames", [&](size_t i) {
+    return createJwt("86.247.11.52", benchUsernames[i % benchUsernames.size()], 1800).size();
+  });
+
+  // every token is seen once for the cold pass, then the cache answers
+  std::vector<std::string> tokens;
+  if (benchSelected("isJwtValid")) {
+    for (size_t i = 0; i < coldTokenCount; i++) {
+      tokens.push_back(createJwt("86.247.11.52", benchUsernames[i % benchUsernames.size()], 1800));
+    }
+  }
+  runBench("isJwtValid", "cold", [&](size_t i) {
+    return static_cast<size_t>(isJwtValid(tokens[i]));
+  }, coldTokenCount);
+  runBench("isJwtValid", "cached", [&](size_t i) {
+    return static_cast<size_t>(isJwtValid(tokens[i % tokens.size()]));
+  });
+
+  runBench("hashPassword", "scrypt", [&](size_t) {
+    return hashPassword(benchPassword).size();
+  });
+}
@@ -0,0 +1,87 @@
+#include "bench.h"
+#include "db.h"
+#include "http.h"
+#include "json.h"
+
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <bsoncxx/json.hpp>
+
+// captured requests are stored with plain newlines, the header lines get
+// their CRLF back so parseRequest sees what came off the socket
+std::vector<std::pair<std::string, std::string>> loadRequests() {
+  std::vector<std::pair<std::string, std::string>> requests;
+  std::istringstream stream(readFixture("requests.txt"));
+  std::string line;
+  bool inBody = false;
+  while (std::getline(stream, line)) {
+    if (line.rfind("### ", 0) == 0) {
+      requests.emplace_back(line.substr(4), "");
+      inBody = false;
+    } else if (!requests.empty()) {
+      std::string& raw = requests.back().second;
+      if (inBody) {
+        raw += line + "\n";
+      } else {
+        raw += line + "\r\n";
+        inBody = line.empty();
+      }
+    }
+  }
+  return requests;
+}
+
+std::string bodyOf(const std::string& raw) {
+  size_t end = raw.find("\r\n\r\n");
+  return end == std::string::npos ? "" : raw.substr(end + 4);
+}
+
+void benchParsing() {
+  for (const auto& [name, raw] : loadRequests()) {
+    runBench("parseRequest", name, [&](size_t) {
+      return parseRequest(raw).headers.size();
+    });
+  }
+  for (const auto& [name, raw] : loadRequests()) {
+    std::string body = bodyOf(raw);
+    if (body.empty()) continue;
+    runBench("parseBody", name, [&](size_t) {
+      std::istringstream stream(body);
+      return parseBody(stream).object.size();
+    });
+  }
+
+  std::vector<std::string> queries = readFixtureLines("queries.txt");
+  std::vector<std::string> decoded;
+  for (const auto& query : queries) {
+    decoded.push_back(urlDecode(query));
+  }
+  runBench("urlDecode", "queries", [&](size_t i) {
+    return urlDecode(queries[i % queries.size()]).size();
+  });
+  runBench("urlEncode", "queries", [&](size_t i) {
+    return urlEncode(decoded[i % decoded.size()]).size();
+  });
+
+  // stored anime documents in relaxed extended JSON, as mongoexport writes them
+  std::vector<std::string> anime = readFixtureLines("anime.jsonl");
+  std::vector<Json> built;
+  std::vector<bsoncxx::document::value> documents;
+  for (const auto& line : anime) {
+    std::istringstream stream(line);
+    built.push_back(buildJson(stream));
+    documents.push_back(bsoncxx::from_json(line));
+  }
+  runBench("buildJson", "anime", [&](size_t i) {
+    std::istringstream stream(anime[i % anime.size()]);
+    return buildJson(stream).object.size();
+  });
+  runBench("jsonToString", "anime", [&](size_t i) {
+    return jsonToString(built[i % built.size()]).size();
+  });
+  runBench("parseDocument", "anime", [&](size_t i) {
+    return parseDocument(documents[i % documents.size()].view()).object.size();
+  });
+}
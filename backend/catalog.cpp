@@ -0,0 +1,228 @@
+#include "catalog.h"
+#include "fuzzy.h"
+#include "search.h"
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <bsoncxx/types.hpp>
+
+std::shared_mutex catalogMtx;
+std::vector<std::shared_ptr<const CatalogEntry>> catalog;
+std::unordered_map<std::string, uint32_t> catalogIndex;
+std::atomic<uint64_t> catalogUpdates(0);
+
+std::mutex featureNamesMtx;
+std::vector<std::string> genreNames(maxGenreId);
+std::unordered_map<std::string, uint8_t> internedNames;
+
+int64_t numberField(const bsoncxx::document::element& element, int64_t fallback) {
+  if (!element) return fallback;
+  switch (element.type()) {
+    case bsoncxx::type::k_int32:
+      return element.get_int32().value;
+    case bsoncxx::type::k_int64:
+      return element.get_int64().value;
+    case bsoncxx::type::k_double:
+      return static_cast<int64_t>(element.get_double().value);
+    default:
+      return fallback;
+  }
+}
+
+std::string stringField(const bsoncxx::document::element& element) {
+  if (!element || element.type() != bsoncxx::type::k_string) return "";
+  return std::string(element.get_string().value);
+}
+
+uint8_t internName(const std::string& name) {
+  if (name.empty()) return 0;
+  std::lock_guard<std::mutex> lock(featureNamesMtx);
+  auto it = internedNames.find(name);
+  if (it != internedNames.end()) return it->second;
+  if (internedNames.size() >= 255) return 0;
+  uint8_t id = static_cast<uint8_t>(internedNames.size() + 1);
+  internedNames.emplace(name, id);
+  return id;
+}
+
+uint8_t seasonIndex(const std::string& season) {
+  if (season == "winter") return 1;
+  if (season == "spring") return 2;
+  if (season == "summer") return 3;
+  if (season == "fall") return 4;
+  return 0;
+}
+
+AnimeFeatures createFeatures(const bsoncxx::document::view& anime) {
+  AnimeFeatures features;
+
+  auto genres = anime["genres"];
+  if (genres && genres.type() == bsoncxx::type::k_array) {
+    for (auto&& genre : genres.get_array().value) {
+      if (genre.type() != bsoncxx::type::k_document) continue;
+      auto genreDoc = genre.get_document().value;
+      int64_t id = numberField(genreDoc["id"], -1);
+      if (id < 0 || id >= maxGenreId) continue;
+      features.genres[id / 64] |= uint64_t(1) << (id % 64);
+      std::lock_guard<std::mutex> lock(featureNamesMtx);
+      if (genreNames[id].empty()) {
+        genreNames[id] = stringField(genreDoc["name"]);
+      }
+    }
+  }
+
+  auto studios = anime["studios"];
+  if (studios && studios.type() == bsoncxx::type::k_array) {
+    size_t count = 0;
+    for (auto&& studio : studios.get_array().value) {
+      if (count == maxStudios) break;
+      if (studio.type() != bsoncxx::type::k_document) continue;
+      int64_t id = numberField(studio.get_document().value["id"], 0);
+      if (id > 0 && id <= UINT16_MAX) {
+        features.studios[count++] = static_cast<uint16_t>(id);
+      }
+    }
+  }
+
+  auto season = anime["start_season"];
+  if (season && season.type() == bsoncxx::type::k_document) {
+    auto seasonDoc = season.get_document().value;
+    features.year = static_cast<uint16_t>(numberField(seasonDoc["year"], 0));
+    features.season = seasonIndex(stringField(seasonDoc["season"]));
+  }
+
+  features.episodes = static_cast<uint16_t>(numberField(anime["num_episodes"], 0));
+  auto mean = anime["mean"];
+  if (mean && mean.type() == bsoncxx::type::k_double) {
+    features.score = static_cast<uint16_t>(mean.get_double().value * 100 + 0.5);
+  } else {
+    features.score = static_cast<uint16_t>(numberField(mean, 0) * 100);
+  }
+  features.mediaType = internName(stringField(anime["media_type"]));
+  features.source = internName(stringField(anime["source"]));
+  features.rating = internName(stringField(anime["rating"]));
+
+  return features;
+}
+
+std::shared_ptr<const CatalogEntry> createCatalogEntry(const bsoncxx::document::view& anime) {
+  auto entry = std::make_shared<CatalogEntry>();
+  entry->id = anime["_id"].get_oid().value.to_string();
+  entry->title = stringField(anime["title"]);
+  entry->popularity = static_cast<int>(numberField(anime["popularity"], INT_MAX));
+  entry->features = createFeatures(anime);
+
+  auto alternative = anime["alternative_titles"];
+  if (alternative && alternative.type() == bsoncxx::type::k_document) {
+    auto titles = alternative.get_document().value;
+    entry->english = stringField(titles["en"]);
+    auto synonyms = titles["synonyms"];
+    if (synonyms && synonyms.type() == bsoncxx::type::k_array) {
+      for (auto&& synonym : synonyms.get_array().value) {
+        if (synonym.type() == bsoncxx::type::k_string) {
+          entry->synonyms.emplace_back(synonym.get_string().value);
+        }
+      }
+    }
+  }
+
+  auto characters = anime["characters"];
+  if (characters && characters.type() == bsoncxx::type::k_array) {
+    for (auto&& character : characters.get_array().value) {
+      int64_t id = 0;
+      if (character.type() == bsoncxx::type::k_document) {
+        id = numberField(character.get_document().value["id"], 0);
+      } else if (character.type() == bsoncxx::type::k_int32) {
+        id = character.get_int32().value;
+      } else if (character.type() == bsoncxx::type::k_int64) {
+        id = character.get_int64().value;
+      }
+      if (id > 0 && id <= UINT32_MAX) {
+        entry->characters.push_back(static_cast<uint32_t>(id));
+      }
+    }
+  }
+
+  auto pictures = anime["pictures"];
+  if (pictures && pictures.type() == bsoncxx::type::k_array) {
+    for (auto&& picture : pictures.get_array().value) {
+      if (picture.type() != bsoncxx::type::k_document) continue;
+      auto pictureDoc = picture.get_document().value;
+      std::string url = stringField(pictureDoc["large"]);
+      if (url.empty()) url = stringField(pictureDoc["medium"]);
+      if (!url.empty()) entry->pictures.push_back(url);
+    }
+  }
+
+  return entry;
+}
+
+void upsertCatalogEntry(const bsoncxx::document::view& anime) {
+  auto entry = createCatalogEntry(anime);
+  std::shared_ptr<const CatalogEntry> previous;
+  uint32_t index;
+  {
+    std::unique_lock<std::shared_mutex> lock(catalogMtx);
+    auto it = catalogIndex.find(entry->id);
+    if (it != catalogIndex.end()) {
+      index = it->second;
+      previous = catalog[index];
+      catalog[index] = entry;
+    } else {
+      index = static_cast<uint32_t>(catalog.size());
+      catalog.push_back(entry);
+      catalogIndex.emplace(entry->id, index);
+    }
+    catalogUpdates++;
+  }
+
+  updateSearchIndex(index, previous.get(), *entry);
+  updateFuzzyIndex(index, previous.get(), *entry);
+}
+
+void loadCatalog(Storage& storage) {
+  size_t count = 0;
+  storage.forEachAnime([&](const bsoncxx::document::view& anime) {
+    try {
+      upsertCatalogEntry(anime);
+      count++;
+    } catch (const std::exception& e) {
+      std::cerr << "[catalog.cpp:loadCatalog] " << e.what() << "\n";
+    }
+  });
+  std::cout << "Loaded " << count << " anime into the catalog\n";
+}
+
+std::shared_ptr<const CatalogEntry> getCatalogEntry(uint32_t index) {
+  std::shared_lock<std::shared_mutex> lock(catalogMtx);
+  return index < catalog.size() ? catalog[index] : nullptr;
+}
+
+int64_t findCatalogIndex(const std::string& id) {
+  std::shared_lock<std::shared_mutex> lock(catalogMtx);
+  auto it = catalogIndex.find(id);
+  return it != catalogIndex.end() ? it->second : -1;
+}
+
+std::string getGenreName(unsigned id) {
+  std::lock_guard<std::mutex> lock(featureNamesMtx);
+  return id < maxGenreId ? genreNames[id] : "";
+}
+
+size_t catalogSize() {
+  std::shared_lock<std::shared_mutex> lock(catalogMtx);
+  return catalog.size();
+}
+
+uint64_t catalogVersion() {
+  return catalogUpdates;
+}
@@ -0,0 +1,51 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "storage.h"
+
+#include <bsoncxx/document/view.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr unsigned maxGenreId = 128;
+constexpr size_t maxStudios = 4;
+
+// attributes compared between a guess and the answer, packed so a
+// comparison is a few popcounts and integer compares
+struct AnimeFeatures {
+  uint64_t genres[maxGenreId / 64] = {}; // bit per MAL genre, theme and demographic id
+  uint16_t studios[maxStudios] = {}; // MAL studio ids, 0 when unused
+  uint16_t year = 0;
+  uint8_t season = 0; // 1 winter to 4 fall, 0 unknown
+  uint8_t mediaType = 0; // interned, 0 unknown
+  uint8_t source = 0;
+  uint8_t rating = 0;
+  uint16_t episodes = 0;
+  uint16_t score = 0; // mean score * 100
+};
+
+struct CatalogEntry {
+  std::string id; // _id of the anime document
+  std::string title;
+  std::string english;
+  std::vector<std::string> synonyms;
+  int popularity; // MAL popularity rank, lower is more popular
+  AnimeFeatures features;
+  std::vector<uint32_t> characters; // MAL character ids, main characters first
+  std::vector<std::string> pictures; // screenshot urls
+};
+
+// in-memory copy of the anime collection, entries keep their index for the
+// lifetime of the process so indexes over the catalog can refer to them by it
+void loadCatalog(Storage&);
+void upsertCatalogEntry(const bsoncxx::document::view&);
+
+std::shared_ptr<const CatalogEntry> getCatalogEntry(uint32_t);
+int64_t findCatalogIndex(const std::string&);
+size_t catalogSize();
+uint64_t catalogVersion(); // changes on every upsert
+std::string getGenreName(unsigned);
+
+#endif // CATALOG_H
@@ -0,0 +1,228 @@
+#include "client.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// stand-in upstream on a loopback port, every connection gets its own thread
+// and is answered per path; responses are sent in pieces so the client has to
+// frame across partial reads
+struct StandInResponse {
+  std::vector<std::string> parts;
+  bool closeAfter = false; // closes the connection once the response is sent
+};
+
+std::atomic<int> acceptedConnections(0);
+
+const std::string lengthResponse =
+  "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 11\r\n\r\nhello world";
+const std::string chunkedResponse =
+  "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+  "5\r\nhello\r\n1;ext=1\r\n \r\n10\r\n0123456789abcdef\r\n0\r\nX-Trailer: done\r\n\r\n";
+const std::string notModifiedResponse =
+  "HTTP/1.1 304 Not Modified\r\nETag: \"abc\"\r\nContent-Length: 11\r\n\r\n";
+const std::string headResponse =
+  "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\n";
+const std::string untilCloseResponse =
+  "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nread until the end";
+const std::string http10Response =
+  "HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+StandInResponse createStandInResponse(const std::string& method, const std::string& path) {
+  StandInResponse response;
+  if (method == "HEAD") {
+    response.parts = { headResponse };
+  } else if (path == "/length") {
+    response.parts = { lengthResponse.substr(0, 20), lengthResponse.substr(20, 45), lengthResponse.substr(65) };
+  } else if (path == "/chunked") {
+    size_t middle = chunkedResponse.find("10\r\n") + 6;
+    response.parts = { chunkedResponse.substr(0, 50), chunkedResponse.substr(50, middle - 50), chunkedResponse.substr(middle) };
+  } else if (path == "/not-modified") {
+    response.parts = { notModifiedResponse };
+  } else if (path == "/until-close") {
+    response.parts = { untilCloseResponse.substr(0, 40), untilCloseResponse.substr(40) };
+    response.closeAfter = true;
+  } else if (path == "/http10") {
+    response.parts = { http10Response };
+    response.closeAfter = true;
+  } else if (path == "/drop") {
+    // answers as keep-alive, then goes away while the client pools the socket
+    response.parts = { lengthResponse };
+    response.closeAfter = true;
+  } else {
+    response.parts = { "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n" };
+  }
+  return response;
+}
+
+void serveConnection(int clientFd) {
+  std::string buffer;
+  char chunk[4096];
+  while (true) {
+    size_t headEnd;
+    while ((headEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+      ssize_t bytes = recv(clientFd, chunk, sizeof(chunk), 0);
+      if (bytes <= 0) {
+        close(clientFd);
+        return;
+      }
+      buffer.append(chunk, bytes);
+    }
+    std::string requestLine = buffer.substr(0, buffer.find("\r\n"));
+    buffer.erase(0, headEnd + 4);
+
+    size_t space = requestLine.find(' ');
+    std::string method = requestLine.substr(0, space);
+    std::string path = requestLine.substr(space + 1, requestLine.find(' ', space + 1) - space - 1);
+    StandInResponse response = createStandInResponse(method, path);
+    for (const auto& part : response.parts) {
+      send(clientFd, part.data(), part.size(), MSG_NOSIGNAL);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    if (response.closeAfter) {
+      close(clientFd);
+      return;
+    }
+  }
+}
+
+int startStandInServer(int& port) {
+  int serverFd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t length = sizeof(address);
+  if (serverFd == -1 ||
+      bind(serverFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 ||
+      listen(serverFd, 16) == -1 ||
+      getsockname(serverFd, reinterpret_cast<sockaddr*>(&address), &length) == -1) {
+    std::cerr << "[client_check.cpp:startStandInServer] " << std::strerror(errno) << "\n";
+    throw std::runtime_error("Failed to start stand-in server");
+  }
+  port = ntohs(address.sin_port);
+
+  std::thread([serverFd]() {
+    while (true) {
+      int clientFd = accept(serverFd, nullptr, nullptr);
+      if (clientFd == -1) continue;
+      acceptedConnections++;
+      std::thread(serveConnection, clientFd).detach();
+    }
+  }).detach();
+  return serverFd;
+}
+
+std::string authority;
+
+std::string request(const std::string& method, const std::string& path) {
+  return sendHttpRequest(authority, method + " " + path + " HTTP/1.1\r\nHost: " + authority + "\r\n\r\n");
+}
+
+int failures = 0;
+
+void check(const std::string& name, const std::function<void()>& body) {
+  try {
+    body();
+    std::cout << "ok   " << name << "\n";
+  } catch (const std::exception& e) {
+    std::cout << "FAIL " << name << ": " << e.what() << "\n";
+    failures++;
+  }
+}
+
+void expect(bool condition, const std::string& what) {
+  if (!condition) throw std::runtime_error(what);
+}
+
+void expectResponse(const std::string& actual, const std::string& expected) {
+  expect(actual == expected, "got \"" + actual + "\", expected \"" + expected + "\"");
+}
+
+// the connection count the stand-in accepted since the last call
+int newConnections() {
+  static int seen = 0;
+  int accepted = acceptedConnections.load();
+  int fresh = accepted - seen;
+  seen = accepted;
+  return fresh;
+}
+
+int main() {
+  int port;
+  startStandInServer(port);
+  authority = "127.0.0.1:" + std::to_string(port);
+
+  check("content-length keep-alive reuses one connection", []() {
+    for (int i = 0; i < 3; i++) {
+      expectResponse(request("GET", "/length"), lengthResponse);
+    }
+    expect(newConnections() == 1, "expected one connection");
+    expect(idleConnectionCount() == 1, "expected the connection to be pooled");
+  });
+
+  check("chunked body with extension and trailer", []() {
+    expectResponse(request("GET", "/chunked"), chunkedResponse);
+    expect(newConnections() == 0, "expected the pooled connection to be reused");
+    expectResponse(request("GET", "/length"), lengthResponse);
+    expect(newConnections() == 0, "expected the connection to stay usable after the chunks");
+  });
+
+  check("304 with a content-length has no body", []() {
+    expectResponse(request("GET", "/not-modified"), notModifiedResponse);
+    expectResponse(request("GET", "/length"), lengthResponse);
+    expect(newConnections() == 0, "expected the connection to stay usable after the 304");
+  });
+
+  check("HEAD with a content-length has no body", []() {
+    expectResponse(request("HEAD", "/length"), headResponse);
+    expectResponse(request("GET", "/length"), lengthResponse);
+    expect(newConnections() == 0, "expected the connection to stay usable after the HEAD");
+  });
+
+  check("body until close is not pooled", []() {
+    closeIdleConnections();
+    expectResponse(request("GET", "/until-close"), untilCloseResponse);
+    expect(newConnections() == 1, "expected a new connection");
+    expect(idleConnectionCount() == 0, "expected nothing pooled");
+  });
+
+  check("HTTP/1.0 is not pooled", []() {
+    expectResponse(request("GET", "/http10"), http10Response);
+    expect(newConnections() == 1, "expected a new connection");
+    expect(idleConnectionCount() == 0, "expected nothing pooled");
+  });
+
+  check("pooled connection closed by the server is replaced", []() {
+    expectResponse(request("GET", "/drop"), lengthResponse);
+    expect(idleConnectionCount() == 1, "expected the dropped connection to be pooled");
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    expectResponse(request("GET", "/length"), lengthResponse);
+    expect(newConnections() == 2, "expected a fresh connection after the drop");
+  });
+
+  check("idle limit closes extra connections", []() {
+    closeIdleConnections();
+    setMaxIdleConnections(0);
+    expectResponse(request("GET", "/length"), lengthResponse);
+    expect(idleConnectionCount() == 0, "expected nothing pooled");
+    setMaxIdleConnections(8);
+    newConnections();
+  });
+
+  closeIdleConnections();
+  std::cout << (failures ? "client check failed\n" : "client check passed\n");
+  return failures ? 1 : 0;
+}
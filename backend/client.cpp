@@ -0,0 +1,404 @@
+#include "client.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+constexpr auto dnsTtl = std::chrono::minutes(5);
+constexpr auto connectTimeout = std::chrono::seconds(5);
+constexpr auto readTimeout = std::chrono::seconds(10);
+constexpr auto idleTimeout = std::chrono::seconds(30);
+constexpr size_t maxResponseSize = 64 * 1024 * 1024;
+
+struct Address {
+  sockaddr_storage storage;
+  socklen_t length;
+};
+
+struct ResolvedHost {
+  std::vector<Address> addresses;
+  std::chrono::steady_clock::time_point expiresAt;
+};
+
+struct IdleConnection {
+  int fd;
+  std::chrono::steady_clock::time_point idleSince;
+};
+
+std::mutex dnsMtx;
+std::unordered_map<std::string, ResolvedHost> dnsCache; // host:port -> addresses
+
+std::mutex poolMtx;
+std::unordered_map<std::string, std::vector<IdleConnection>> connectionPool; // host:port -> idle sockets
+size_t maxIdlePerHost = 8;
+
+void splitAuthority(const std::string& authority, std::string& host, std::string& port) {
+  size_t colon = authority.rfind(':');
+  if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+    host = authority.substr(0, colon);
+    port = authority.substr(colon + 1);
+  } else {
+    host = authority;
+    port = "80";
+  }
+  if (host.size() > 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+}
+
+std::vector<Address> resolveHost(const std::string& authority) {
+  auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(dnsMtx);
+    auto cached = dnsCache.find(authority);
+    if (cached != dnsCache.end() && cached->second.expiresAt > now) {
+      return cached->second.addresses;
+    }
+  }
+
+  std::string host, port;
+  splitAuthority(authority, host, port);
+  struct addrinfo hints{}, *serverInfo;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &serverInfo);
+  if (status != 0) {
+    std::cerr << "[client.cpp:resolveHost] Failed to resolve " << authority << ": " << gai_strerror(status) << "\n";
+    throw std::runtime_error("Failed to resolve host");
+  }
+
+  ResolvedHost resolved;
+  for (auto* info = serverInfo; info; info = info->ai_next) {
+    Address address{};
+    std::memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+    address.length = info->ai_addrlen;
+    resolved.addresses.push_back(address);
+  }
+  freeaddrinfo(serverInfo);
+  resolved.expiresAt = now + dnsTtl;
+
+  std::lock_guard<std::mutex> lock(dnsMtx);
+  dnsCache[authority] = resolved;
+  return resolved.addresses;
+}
+
+void forgetHost(const std::string& authority) {
+  std::lock_guard<std::mutex> lock(dnsMtx);
+  dnsCache.erase(authority);
+}
+
+// non-blocking connect bounded by connectTimeout, the socket is blocking with
+// send and receive timeouts afterwards
+int connectWithTimeout(const Address& address) {
+  int sock = socket(address.storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock == -1) return -1;
+
+  int flags = fcntl(sock, F_GETFL, 0);
+  fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+  if (connect(sock, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == -1) {
+    if (errno != EINPROGRESS) {
+      close(sock);
+      return -1;
+    }
+    pollfd pfd{ sock, POLLOUT, 0 };
+    int timeoutMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(connectTimeout).count());
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    if (poll(&pfd, 1, timeoutMs) != 1 ||
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errorLength) == -1 || error != 0) {
+      close(sock);
+      return -1;
+    }
+  }
+  fcntl(sock, F_SETFL, flags);
+
+  timeval timeout{};
+  timeout.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(readTimeout).count();
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  int noDelay = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return sock;
+}
+
+int openConnection(const std::string& authority) {
+  for (const auto& address : resolveHost(authority)) {
+    int sock = connectWithTimeout(address);
+    if (sock != -1) return sock;
+  }
+  // the addresses may have changed, resolve again on the next attempt
+  forgetHost(authority);
+  std::cerr << "[client.cpp:openConnection] Failed to connect to " << authority << "\n";
+  throw std::runtime_error("Failed to connect");
+}
+
+// an idle socket that is readable was either closed by the peer or sent
+// something unsolicited, neither can be reused
+bool isReusable(const IdleConnection& connection, std::chrono::steady_clock::time_point now) {
+  if (now - connection.idleSince > idleTimeout) return false;
+  pollfd pfd{ connection.fd, POLLIN, 0 };
+  return poll(&pfd, 1, 0) == 0;
+}
+
+int takeIdleConnection(const std::string& authority) {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(poolMtx);
+  auto& idle = connectionPool[authority];
+  while (!idle.empty()) {
+    IdleConnection connection = idle.back();
+    idle.pop_back();
+    if (isReusable(connection, now)) return connection.fd;
+    close(connection.fd);
+  }
+  return -1;
+}
+
+void releaseConnection(const std::string& authority, int sock) {
+  std::lock_guard<std::mutex> lock(poolMtx);
+  auto& idle = connectionPool[authority];
+  if (idle.size() >= maxIdlePerHost) {
+    close(sock);
+    return;
+  }
+  idle.push_back(IdleConnection{ sock, std::chrono::steady_clock::now() });
+}
+
+void setMaxIdleConnections(size_t count) {
+  std::lock_guard<std::mutex> lock(poolMtx);
+  maxIdlePerHost = count;
+}
+
+size_t idleConnectionCount() {
+  std::lock_guard<std::mutex> lock(poolMtx);
+  size_t count = 0;
+  for (const auto& [authority, idle] : connectionPool) {
+    count += idle.size();
+  }
+  return count;
+}
+
+void closeIdleConnections() {
+  std::lock_guard<std::mutex> lock(poolMtx);
+  for (auto& [authority, idle] : connectionPool) {
+    for (const auto& connection : idle) {
+      close(connection.fd);
+    }
+  }
+  connectionPool.clear();
+}
+
+bool sendAll(int sock, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t bytes = send(sock, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (bytes == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    sent += bytes;
+  }
+  return true;
+}
+
+bool equalsIgnoreCase(const std::string& a, const char* b) {
+  size_t length = std::strlen(b);
+  if (a.size() != length) return false;
+  for (size_t i = 0; i < length; i++) {
+    if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) return false;
+  }
+  return true;
+}
+
+enum class Framing {
+  NONE,
+  CONTENT_LENGTH,
+  CHUNKED,
+  UNTIL_CLOSE
+};
+
+struct ResponseFrame {
+  size_t headerEnd = 0; // offset of the body, 0 while the head is incomplete
+  Framing framing = Framing::NONE;
+  size_t contentLength = 0;
+  size_t chunkPos = 0; // start of the next chunk size line
+  bool keepAlive = true;
+};
+
+void parseHead(const std::string& raw, bool isHead, ResponseFrame& frame) {
+  size_t lineEnd = raw.find("\r\n");
+  std::string statusLine = raw.substr(0, lineEnd);
+  if (statusLine.compare(0, 5, "HTTP/") != 0 || statusLine.size() < 12) {
+    throw std::runtime_error("Malformed status line");
+  }
+  int status = std::atoi(statusLine.c_str() + 9);
+  frame.keepAlive = statusLine.compare(0, 8, "HTTP/1.0") != 0;
+
+  bool chunked = false;
+  bool hasLength = false;
+  size_t pos = lineEnd + 2;
+  while (pos < frame.headerEnd - 2) {
+    size_t end = raw.find("\r\n", pos);
+    size_t colon = raw.find(':', pos);
+    if (colon != std::string::npos && colon < end) {
+      std::string key = raw.substr(pos, colon - pos);
+      std::string value = raw.substr(colon + 1, end - colon - 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t") + 1);
+      if (equalsIgnoreCase(key, "Content-Length")) {
+        frame.contentLength = std::strtoull(value.c_str(), nullptr, 10);
+        hasLength = true;
+      } else if (equalsIgnoreCase(key, "Transfer-Encoding")) {
+        chunked = value.size() >= 7 && equalsIgnoreCase(value.substr(value.size() - 7), "chunked");
+      } else if (equalsIgnoreCase(key, "Connection")) {
+        if (equalsIgnoreCase(value, "close")) frame.keepAlive = false;
+        if (equalsIgnoreCase(value, "keep-alive")) frame.keepAlive = true;
+      }
+    }
+    pos = end + 2;
+  }
+
+  if (isHead || status / 100 == 1 || status == 204 || status == 304) {
+    frame.framing = Framing::NONE;
+  } else if (chunked) {
+    frame.framing = Framing::CHUNKED;
+    frame.chunkPos = frame.headerEnd;
+  } else if (hasLength) {
+    frame.framing = Framing::CONTENT_LENGTH;
+  } else {
+    frame.framing = Framing::UNTIL_CLOSE;
+    frame.keepAlive = false;
+  }
+  if (frame.contentLength > maxResponseSize) {
+    throw std::runtime_error("Response too large");
+  }
+}
+
+// advances over the chunks received so far, true once the last chunk and trailers are in
+bool scanChunks(const std::string& raw, ResponseFrame& frame) {
+  while (true) {
+    size_t lineEnd = raw.find("\r\n", frame.chunkPos);
+    if (lineEnd == std::string::npos) return false;
+    size_t size = std::strtoull(raw.c_str() + frame.chunkPos, nullptr, 16);
+    if (size == 0) {
+      if (raw.compare(lineEnd + 2, 2, "\r\n") == 0) return true;
+      return raw.find("\r\n\r\n", lineEnd) != std::string::npos;
+    }
+    size_t next = lineEnd + 2 + size + 2;
+    if (next > raw.size()) return false;
+    frame.chunkPos = next;
+  }
+}
+
+bool isComplete(const std::string& raw, ResponseFrame& frame) {
+  switch (frame.framing) {
+    case Framing::NONE:
+      return true;
+    case Framing::CONTENT_LENGTH:
+      return raw.size() >= frame.headerEnd + frame.contentLength;
+    case Framing::CHUNKED:
+      return scanChunks(raw, frame);
+    default:
+      return false;
+  }
+}
+
+// false when the peer closed the connection before sending anything, which
+// happens when a pooled connection timed out on the server side
+bool readResponse(int sock, bool isHead, std::string& raw, bool& keepAlive) {
+  char buffer[16384];
+  ResponseFrame frame;
+
+  while (true) {
+    ssize_t bytes = recv(sock, buffer, sizeof(buffer), 0);
+    if (bytes == -1) {
+      if (errno == EINTR) continue;
+      if (errno == ECONNRESET && raw.empty()) return false;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) throw std::runtime_error("Read timed out");
+      throw std::runtime_error("Failed to read response");
+    }
+    if (bytes == 0) {
+      if (raw.empty()) return false;
+      if (frame.headerEnd != 0 && frame.framing == Framing::UNTIL_CLOSE) break;
+      throw std::runtime_error("Connection closed mid response");
+    }
+
+    size_t previous = raw.size();
+    raw.append(buffer, bytes);
+    if (raw.size() > maxResponseSize) {
+      throw std::runtime_error("Response too large");
+    }
+
+    if (frame.headerEnd == 0) {
+      size_t end = raw.find("\r\n\r\n", previous < 3 ? 0 : previous - 3);
+      if (end == std::string::npos) continue;
+      frame.headerEnd = end + 4;
+      parseHead(raw, isHead, frame);
+    }
+    if (isComplete(raw, frame)) break;
+  }
+
+  if (frame.framing == Framing::CONTENT_LENGTH) {
+    raw.resize(frame.headerEnd + frame.contentLength);
+  }
+  keepAlive = frame.keepAlive;
+  return true;
+}
+
+std::string sendHttpRequest(const std::string& authority, const std::string& request) {
+  bool isHead = request.compare(0, 5, "HEAD ") == 0;
+
+  // a pooled connection may have been closed by the server in the meantime,
+  // fall through to the next one and finally to a fresh connection
+  while (true) {
+    int sock = takeIdleConnection(authority);
+    bool reused = sock != -1;
+    recordCacheLookup(CacheKind::UPSTREAM_CONNECTION, reused);
+    if (!reused) {
+      sock = openConnection(authority);
+    }
+
+    std::string response;
+    bool keepAlive = false;
+    bool answered = false;
+    try {
+      answered = sendAll(sock, request) && readResponse(sock, isHead, response, keepAlive);
+    } catch (const std::exception& e) {
+      close(sock);
+      std::cerr << "[client.cpp:sendHttpRequest] " << authority << ": " << e.what() << "\n";
+      throw;
+    }
+
+    if (answered) {
+      if (keepAlive) {
+        releaseConnection(authority, sock);
+      } else {
+        close(sock);
+      }
+      return response;
+    }
+
+    close(sock);
+    if (!reused) {
+      std::cerr << "[client.cpp:sendHttpRequest] " << authority << ": connection closed without response\n";
+      throw std::runtime_error("Connection closed without response");
+    }
+  }
+}
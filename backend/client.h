@@ -0,0 +1,16 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <cstddef>
+#include <string>
+
+// sends a raw HTTP/1.1 request to "host[:port]" and returns the raw response once
+// it is fully framed, connections are kept alive and reused per host
+std::string sendHttpRequest(const std::string&, const std::string&);
+
+// per host, 8 unless changed
+void setMaxIdleConnections(size_t);
+void closeIdleConnections();
+size_t idleConnectionCount();
+
+#endif // CLIENT_H
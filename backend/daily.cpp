@@ -0,0 +1,376 @@
+#include "daily.h"
+#include "catalog.h"
+#include "day.h"
+#include "db.h"
+#include "guess.h"
+#include "http.h"
+#include "json.h"
+#include "types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+
+std::atomic<int32_t> currentDay(0);
+std::atomic<int64_t> rolloverAt(0);
+
+struct CachedDaily {
+  std::string animeId;
+  std::vector<std::vector<uint32_t>> characterRounds; // characters shown per round of the character game
+  std::string body;
+  std::string etag;
+  std::string lastModified;
+};
+
+std::shared_mutex dailyCacheMtx;
+std::map<Day, std::shared_ptr<const CachedDaily>> dailyCache;
+std::set<Day> missingDailies; // past days a range read found no daily for
+
+std::mutex schedulerMtx;
+std::condition_variable schedulerCv;
+std::atomic<bool> schedulerRunning(false);
+std::thread schedulerThread;
+int schedulerDaysAhead = 0;
+
+// seeded once per thread, the scheduler creates several days within the same second
+int getRandom(int interval_max) {
+  thread_local std::mt19937 rng{ std::random_device{}() };
+  return std::uniform_int_distribution<int>(0, interval_max - 1)(rng);
+}
+
+Json getOrCreateDaily(Day day, Storage& storage) {
+  using bsoncxx::builder::basic::kvp;
+  using bsoncxx::builder::basic::make_document;
+
+  Json response;
+  auto document = storage.findDaily(day);
+
+  if (!document) {
+    size_t count = storage.countAnime();
+    if (count == 0) {
+      std::cerr << "[daily.cpp:getOrCreateDaily] no anime to pick from, day: " << formatDay(day) << "\n";
+      throw std::runtime_error("getOrCreateDaily");
+    }
+    int skip = 0;
+    int difficulty = getRandom(9) + 1;
+    std::string diff;
+    if (difficulty <= 5) {
+      skip = getRandom(499);
+      diff = "easy";
+    } else if (difficulty <= 8) {
+      skip = getRandom(2999);
+      diff = "medium";
+    } else {
+      skip = getRandom(5999);
+      diff = "hard";
+    }
+    // small catalogs (a seeded in-memory storage) still get a daily
+    skip = std::min<size_t>(skip, count - 1);
+
+    // entries are kept fresh by the ingestion pipeline
+    auto anime = storage.findAnimeAt(skip);
+    if (!anime) {
+      std::cerr << "[daily.cpp:getOrCreateDaily] found none"
+        << ", skip: " << skip
+        << ", day: " << formatDay(day)
+        << ", count: " << count
+        << "\n";
+      throw std::runtime_error("getOrCreateDaily");
+    }
+
+    auto id = anime->view()["_id"].get_oid();
+    std::cout << "Created entry for " << formatDay(day)
+      << " with anime: \"" << anime->view()["title"].get_string().value.data()
+      << "\" and difficulty: " << diff
+      << "\n";
+    // guesses are built here once so serving the daily stays a cache read
+    DailyGuesses guesses;
+    int64_t answerIndex = findCatalogIndex(id.value.to_string());
+    if (answerIndex >= 0) {
+      guesses = createDailyGuesses(static_cast<uint32_t>(answerIndex));
+    }
+    bsoncxx::builder::basic::array screenshotGuess;
+    for (const auto& screenshot : guesses.screenshots) {
+      screenshotGuess.append(screenshot);
+    }
+    bsoncxx::builder::basic::array characterGuess;
+    for (const auto& round : guesses.characters) {
+      bsoncxx::builder::basic::array characters;
+      for (uint32_t character : round) {
+        characters.append(static_cast<int32_t>(character));
+      }
+      characterGuess.append(characters.extract());
+    }
+
+    auto doc = make_document(
+      kvp("key", day.value),
+      kvp("day", formatDay(day)),
+      kvp("anime", id),
+      kvp("difficulty", diff),
+      kvp("screenshotGuess", screenshotGuess.extract()),
+      kvp("characterGuess", characterGuess.extract())
+    );
+    std::cout << bsoncxx::to_json(doc) << "\n";
+    // false when another thread created the same day first, its entry is used
+    storage.insertDaily(doc.view());
+    document = storage.findDaily(day);
+  }
+
+  response = parseDocument(document);
+  response.object.erase("key");
+  response.object["anime"] = parseDocument(storage.findAnime(response.object["anime"].oid.value));
+
+  return response;
+}
+
+Day getCurrentDay() {
+  return Day(currentDay.load(std::memory_order_acquire));
+}
+
+std::shared_ptr<const CachedDaily> findCachedDaily(Day day) {
+  std::shared_lock<std::shared_mutex> lock(dailyCacheMtx);
+  auto it = dailyCache.find(day);
+  return it != dailyCache.end() ? it->second : nullptr;
+}
+
+// cached, or a past day known to have no daily
+bool isDailyKnown(Day day) {
+  std::shared_lock<std::shared_mutex> lock(dailyCacheMtx);
+  return dailyCache.count(day) || missingDailies.count(day);
+}
+
+std::shared_ptr<const CachedDaily> storeDaily(Day day, const Json& daily) {
+  auto cached = std::make_shared<CachedDaily>();
+  auto anime = daily.object.find("anime");
+  if (anime != daily.object.end() && anime->second.object.count("_id")) {
+    cached->animeId = anime->second.object.at("_id").oid.value.to_string();
+  }
+  auto characterGuess = daily.object.find("characterGuess");
+  if (characterGuess != daily.object.end()) {
+    for (const auto& round : characterGuess->second.array) {
+      std::vector<uint32_t> characters;
+      for (const auto& character : round.array) {
+        uint32_t id;
+        const char* end = character.value.data() + character.value.size();
+        if (std::from_chars(character.value.data(), end, id).ptr == end) characters.push_back(id);
+      }
+      cached->characterRounds.push_back(std::move(characters));
+    }
+  }
+  cached->body = jsonToString(daily);
+  cached->etag = computeETag(cached->body);
+  cached->lastModified = httpDate(static_cast<std::time_t>(day.value) * 24 * 60 * 60);
+  std::unique_lock<std::shared_mutex> lock(dailyCacheMtx);
+  missingDailies.erase(day);
+  return dailyCache.emplace(day, std::move(cached)).first->second;
+}
+
+std::shared_ptr<const CachedDaily> cacheDaily(Day day, Storage& storage) {
+  return storeDaily(day, getOrCreateDaily(day, storage));
+}
+
+// past dailies never change, the current one can be cached until rollover
+CacheMetadata dailyCacheMetadata(Day day, const CachedDaily& cached) {
+  CacheMetadata metadata;
+  metadata.etag = cached.etag;
+  metadata.lastModified = cached.lastModified;
+  if (day < getCurrentDay()) {
+    metadata.cacheControl = "public, max-age=31536000, immutable";
+  } else {
+    int64_t remaining = rolloverAt.load(std::memory_order_relaxed) - std::time(nullptr);
+    metadata.cacheControl = "public, max-age=" + std::to_string(std::max<int64_t>(remaining, 0));
+  }
+  return metadata;
+}
+
+CacheMetadata getDailyCacheMetadata(Day day) {
+  auto cached = findCachedDaily(day);
+  return cached ? dailyCacheMetadata(day, *cached) : CacheMetadata{};
+}
+
+std::string getDailyResponse(Day day, Storage& storage) {
+  auto cached = findCachedDaily(day);
+  if (!cached) {
+    cached = cacheDaily(day, storage);
+  }
+  return createResponse(OK, "application/json", cached->body, dailyCacheMetadata(day, *cached));
+}
+
+std::string getDailyAnimeId(Day day, Storage& storage) {
+  auto cached = findCachedDaily(day);
+  if (!cached) {
+    cached = cacheDaily(day, storage);
+  }
+  return cached->animeId;
+}
+
+std::vector<uint32_t> getDailyCharacterRound(Day day, size_t round, Storage& storage) {
+  auto cached = findCachedDaily(day);
+  if (!cached) {
+    cached = cacheDaily(day, storage);
+  }
+  return round < cached->characterRounds.size() ? cached->characterRounds[round] : std::vector<uint32_t>{};
+}
+
+// loads the existing dailies in [from, to] with one range read and one read
+// for their anime, and caches them; past days without one are remembered so
+// a gap in the range is only read once
+void loadDailies(Day from, Day to, Storage& storage) {
+  std::vector<std::pair<Day, Json>> dailies;
+  std::vector<bsoncxx::oid> animeIds;
+  std::set<Day> found;
+  for (auto&& document : storage.findDailies(from, to)) {
+    Day day(document.view()["key"].get_int32().value);
+    found.insert(day);
+    if (findCachedDaily(day)) continue;
+    Json daily = parseDocument(document.view());
+    daily.object.erase("key");
+    animeIds.push_back(daily.object["anime"].oid.value);
+    dailies.emplace_back(day, std::move(daily));
+  }
+
+  Day today = getCurrentDay();
+  {
+    std::unique_lock<std::shared_mutex> lock(dailyCacheMtx);
+    for (Day day = from; day <= to && day < today; day = day + 1) {
+      if (!found.count(day) && !dailyCache.count(day)) missingDailies.insert(day);
+    }
+  }
+  if (dailies.empty()) return;
+
+  std::unordered_map<std::string, Json> animes;
+  for (auto&& document : storage.findAnime(animeIds)) {
+    animes[document.view()["_id"].get_oid().value.to_string()] = parseDocument(document.view());
+  }
+
+  for (auto& [day, daily] : dailies) {
+    auto anime = animes.find(daily.object["anime"].oid.value.to_string());
+    if (anime == animes.end()) {
+      std::cerr << "[daily.cpp:loadDailies] missing anime for " << formatDay(day) << "\n";
+      if (day < today) {
+        std::unique_lock<std::shared_mutex> lock(dailyCacheMtx);
+        missingDailies.insert(day);
+      }
+      continue;
+    }
+    daily.object["anime"] = anime->second;
+    storeDaily(day, daily);
+  }
+}
+
+std::string getDailiesJson(Day from, Day to, Storage& storage) {
+  bool complete = true;
+  for (Day day = from; day <= to && complete; day = day + 1) {
+    complete = isDailyKnown(day);
+  }
+  if (!complete) {
+    loadDailies(from, to, storage);
+  }
+
+  std::string body = "[";
+  for (Day day = from; day <= to; day = day + 1) {
+    auto cached = findCachedDaily(day);
+    if (!cached) continue;
+    if (body.size() > 1) body += ",";
+    body += cached->body;
+  }
+  body += "]";
+  return body;
+}
+
+// scheduler -------------------------------------------------- scheduler
+
+Day localToday() {
+  std::time_t now = std::time(nullptr);
+  std::tm tm{};
+  localtime_r(&now, &tm);
+  return dayFromCivil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+std::chrono::system_clock::time_point nextRollover() {
+  std::time_t now = std::time(nullptr);
+  std::tm tomorrow{};
+  localtime_r(&now, &tomorrow);
+  tomorrow.tm_mday += 1;
+  tomorrow.tm_hour = 0;
+  tomorrow.tm_min = 0;
+  tomorrow.tm_sec = 0;
+  tomorrow.tm_isdst = -1;
+  return std::chrono::system_clock::from_time_t(std::mktime(&tomorrow));
+}
+
+// creates and caches today and the following days, then flips the served day
+void pregenerateDailies(Storage& storage) {
+  Day today = localToday();
+  for (Day day = today; day <= today + schedulerDaysAhead; day = day + 1) {
+    if (findCachedDaily(day)) continue;
+    try {
+      cacheDaily(day, storage);
+    } catch (const std::exception& e) {
+      std::cerr << "[daily.cpp:pregenerateDailies] " << formatDay(day) << ": " << e.what() << "\n";
+    }
+  }
+
+  rolloverAt.store(std::chrono::system_clock::to_time_t(nextRollover()), std::memory_order_relaxed);
+  if (today != getCurrentDay()) {
+    currentDay.store(today.value, std::memory_order_release);
+    std::cout << "Serving daily for " << formatDay(today) << "\n";
+  }
+}
+
+void schedulerLoop(Storage& storage) {
+  while (schedulerRunning) {
+    {
+      // wake at rollover, and periodically in case the clock jumps
+      auto wakeAt = std::min(nextRollover(), std::chrono::system_clock::now() + std::chrono::minutes(1));
+      std::unique_lock<std::mutex> lock(schedulerMtx);
+      schedulerCv.wait_until(lock, wakeAt, [] { return !schedulerRunning; });
+    }
+    if (!schedulerRunning) break;
+
+    pregenerateDailies(storage);
+  }
+}
+
+void startDailyScheduler(Storage& storage, int daysAhead) {
+  schedulerDaysAhead = daysAhead;
+  pregenerateDailies(storage);
+
+  schedulerRunning = true;
+  schedulerThread = std::thread(schedulerLoop, std::ref(storage));
+}
+
+void stopDailyScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(schedulerMtx);
+    schedulerRunning = false;
+  }
+  schedulerCv.notify_all();
+  if (schedulerThread.joinable()) {
+    schedulerThread.join();
+  }
+}
+
+// !scheduler ------------------------------------------------ !scheduler
@@ -0,0 +1,32 @@
+#ifndef DAILY_H
+#define DAILY_H
+
+#include "day.h"
+#include "storage.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+Json getOrCreateDaily(Day, Storage&);
+
+// day currently served, kept up to date by the scheduler
+Day getCurrentDay();
+
+// rendered /daily response, served from cache and created on miss
+std::string getDailyResponse(Day, Storage&);
+// _id of the day's anime
+std::string getDailyAnimeId(Day, Storage&);
+// characters shown in a round of the character game, empty past the last round
+std::vector<uint32_t> getDailyCharacterRound(Day, size_t, Storage&);
+// caching headers of a cached daily, no etag if the day is not cached
+CacheMetadata getDailyCacheMetadata(Day);
+// JSON array of the existing dailies between two days (inclusive), oldest first
+std::string getDailiesJson(Day, Day, Storage&);
+
+void startDailyScheduler(Storage&, int);
+void stopDailyScheduler();
+
+#endif // DAILY_H
@@ -0,0 +1,96 @@
+#ifndef DAY_H
+#define DAY_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// calendar day stored as days since 01/01/1970, ordered like the dates
+struct Day {
+  int32_t value = 0;
+
+  constexpr Day() = default;
+  constexpr explicit Day(int32_t days) : value(days) {}
+
+  constexpr Day operator+(int32_t days) const { return Day(value + days); }
+  constexpr Day operator-(int32_t days) const { return Day(value - days); }
+  constexpr int32_t operator-(Day other) const { return value - other.value; }
+  constexpr bool operator==(Day other) const { return value == other.value; }
+  constexpr bool operator!=(Day other) const { return value != other.value; }
+  constexpr bool operator<(Day other) const { return value < other.value; }
+  constexpr bool operator<=(Day other) const { return value <= other.value; }
+  constexpr bool operator>(Day other) const { return value > other.value; }
+  constexpr bool operator>=(Day other) const { return value >= other.value; }
+};
+
+struct CivilDate {
+  int year;
+  unsigned month;
+  unsigned day;
+};
+
+// days_from_civil / civil_from_days, http://howardhinnant.github.io/date_algorithms.html
+constexpr Day dayFromCivil(int year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  const int era = (year >= 0 ? year : year - 399) / 400;
+  const unsigned yoe = static_cast<unsigned>(year - era * 400);
+  const unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return Day(era * 146097 + static_cast<int32_t>(doe) - 719468);
+}
+
+constexpr CivilDate civilFromDay(Day d) {
+  const int32_t z = d.value + 719468;
+  const int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const unsigned doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  const unsigned day = doy - (153 * mp + 2) / 5 + 1;
+  const unsigned month = mp < 10 ? mp + 3 : mp - 9;
+  return CivilDate{static_cast<int>(yoe) + era * 400 + (month <= 2), month, day};
+}
+
+constexpr bool isLeapYear(int year) {
+  return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
+
+constexpr unsigned daysInMonth(int year, unsigned month) {
+  constexpr unsigned days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return month == 2 && isLeapYear(year) ? 29 : days[month - 1];
+}
+
+// parses "dd/mm/yyyy", rejecting anything that is not a real calendar day
+constexpr bool parseDay(std::string_view str, Day& out) {
+  if (str.size() != 10 || str[2] != '/' || str[5] != '/') return false;
+  unsigned digits[8] = {};
+  constexpr int positions[8] = { 0, 1, 3, 4, 6, 7, 8, 9 };
+  for (int i = 0; i < 8; i++) {
+    unsigned digit = static_cast<unsigned>(str[positions[i]] - '0');
+    if (digit > 9) return false;
+    digits[i] = digit;
+  }
+  unsigned day = digits[0] * 10 + digits[1];
+  unsigned month = digits[2] * 10 + digits[3];
+  int year = static_cast<int>(digits[4] * 1000 + digits[5] * 100 + digits[6] * 10 + digits[7]);
+  if (month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)) return false;
+  out = dayFromCivil(year, month, day);
+  return true;
+}
+
+// formats as "dd/mm/yyyy"
+inline std::string formatDay(Day d) {
+  CivilDate date = civilFromDay(d);
+  char buffer[10] = {
+    static_cast<char>('0' + date.day / 10), static_cast<char>('0' + date.day % 10), '/',
+    static_cast<char>('0' + date.month / 10), static_cast<char>('0' + date.month % 10), '/',
+    static_cast<char>('0' + date.year / 1000 % 10), static_cast<char>('0' + date.year / 100 % 10),
+    static_cast<char>('0' + date.year / 10 % 10), static_cast<char>('0' + date.year % 10)
+  };
+  return std::string(buffer, sizeof(buffer));
+}
+
+static_assert(dayFromCivil(1970, 1, 1).value == 0, "epoch");
+static_assert(civilFromDay(dayFromCivil(2025, 2, 28) + 1).month == 3, "civil round trip");
+
+#endif // DAY_H
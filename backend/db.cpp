@@ -1,11 +1,19 @@
 #include "db.h"
 #include "json.h"
 #include "types.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <iostream>
 #include <mongocxx/client.hpp>
 #include <mongocxx/uri.hpp>
-#include <mongocxx/client.hpp>
+#include <mongocxx/events/command_failed_event.hpp>
+#include <mongocxx/events/command_started_event.hpp>
+#include <mongocxx/events/command_succeeded_event.hpp>
+#include <mongocxx/options/apm.hpp>
+#include <mongocxx/options/client.hpp>
+#include <mongocxx/options/pool.hpp>
+#include <mongocxx/pool.hpp>
 #include <mongocxx/database.hpp>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
@@ -14,10 +22,26 @@
 #include <bsoncxx/document/view.hpp>
 #include <sstream>
 
-mongocxx::client createDBClient(std::string uri) {
+// every pooled client reports its commands to the metrics and the request
+// trace through the driver's APM hooks, which run on the calling thread
+std::unique_ptr<mongocxx::pool> createDBPool(std::string uri) {
+  mongocxx::options::apm apm;
+  apm.on_command_started([](const mongocxx::events::command_started_event&) {
+    traceMongoStarted();
+  });
+  apm.on_command_succeeded([](const mongocxx::events::command_succeeded_event& event) {
+    traceMongoFinished();
+    recordMongoCommand(std::string(event.command_name()), event.duration(), true);
+  });
+  apm.on_command_failed([](const mongocxx::events::command_failed_event& event) {
+    traceMongoFinished();
+    recordMongoCommand(std::string(event.command_name()), event.duration(), false);
+  });
+  mongocxx::options::client options;
+  options.apm_opts(apm);
+
   mongocxx::uri mongoUri(uri);
-  mongocxx::client client(mongoUri);
-  return client;
+  return std::make_unique<mongocxx::pool>(mongoUri, mongocxx::options::pool(options));
 }
 
 void createCollection(mongocxx::database& db, std::string col) {
@@ -26,12 +50,17 @@ void createCollection(mongocxx::database& db, std::string col) {
   }
 }
 
-Json parseDocument(const bsoncxx::stdx::optional<bsoncxx::document::value>& document) {
-  std::string str = bsoncxx::to_json(document->view());
+Json parseDocument(const bsoncxx::document::view& document) {
+  TraceSpan span(TracePhase::PARSE_DOCUMENT);
+  std::string str = bsoncxx::to_json(document);
   std::istringstream stream(str);
   return buildJson(stream);
 }
 
+Json parseDocument(const bsoncxx::stdx::optional<bsoncxx::document::value>& document) {
+  return parseDocument(document->view());
+}
+
 bsoncxx::builder::basic::array buildArray(const Json&);
 bsoncxx::builder::basic::document buildObject(const Json&);
 
@@ -3,13 +3,15 @@
 
 #include "types.h"
 
+#include <memory>
 #include <mongocxx/database.hpp>
-#include <mongocxx/client.hpp>
+#include <mongocxx/pool.hpp>
 #include <string>
 
-mongocxx::client createDBClient(std::string);
+std::unique_ptr<mongocxx::pool> createDBPool(std::string);
 void createCollection(mongocxx::database&, std::string);
 
+Json parseDocument(const bsoncxx::document::view&);
 Json parseDocument(const bsoncxx::stdx::optional<bsoncxx::document::value>&);
 bsoncxx::document::value createDocument(const Json&);
 
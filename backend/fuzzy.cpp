@@ -0,0 +1,230 @@
+#include "fuzzy.h"
+#include "catalog.h"
+#include "text.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// trigram inverted index over folded titles, candidates sharing enough
+// trigrams with the query are verified with a bounded edit distance
+struct FuzzyTitle {
+  std::string folded;
+  uint32_t entry;
+  bool live;
+};
+
+std::shared_mutex fuzzyMtx;
+std::vector<FuzzyTitle> fuzzyTitles;
+std::unordered_map<uint32_t, std::vector<uint32_t>> fuzzyPostings; // trigram -> title ids
+std::unordered_map<uint32_t, std::vector<uint32_t>> fuzzyEntryTitles; // entry -> title ids
+std::vector<uint32_t> fuzzyFreeTitles; // ids of replaced titles, reused before growing
+
+// distinct trigrams of the title padded with two leading and one trailing marker
+std::vector<uint32_t> trigrams(const std::string& folded) {
+  std::string padded = "\x01\x01" + folded + "\x01";
+  std::vector<uint32_t> grams;
+  grams.reserve(padded.size());
+  for (size_t i = 0; i + 3 <= padded.size(); i++) {
+    grams.push_back(
+      static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16 |
+      static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8 |
+      static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 2]))
+    );
+  }
+  std::sort(grams.begin(), grams.end());
+  grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+  return grams;
+}
+
+// Myers' bit-parallel edit distance (Hyyro's formulation), pattern of at most 64 bytes
+int myersDistance(const std::string& pattern, const std::string& text, int bound) {
+  thread_local uint64_t peq[256] = {};
+  for (size_t i = 0; i < pattern.size(); i++) {
+    peq[static_cast<unsigned char>(pattern[i])] |= uint64_t(1) << i;
+  }
+
+  const uint64_t last = uint64_t(1) << (pattern.size() - 1);
+  const int n = static_cast<int>(text.size());
+  uint64_t pv = ~uint64_t(0);
+  uint64_t mv = 0;
+  int score = static_cast<int>(pattern.size());
+
+  for (int j = 0; j < n; j++) {
+    uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+    uint64_t xv = eq | mv;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    if (ph & last) {
+      score++;
+    } else if (mh & last) {
+      score--;
+    }
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+    // each remaining column lowers the distance by at most one
+    if (score - (n - j - 1) > bound) {
+      score = bound + 1;
+      break;
+    }
+  }
+
+  for (unsigned char c : pattern) {
+    peq[c] = 0;
+  }
+  return std::min(score, bound + 1);
+}
+
+int dynamicDistance(const std::string& a, const std::string& b, int bound) {
+  std::vector<int> previous(b.size() + 1), current(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); j++) {
+    previous[j] = static_cast<int>(j);
+  }
+  for (size_t i = 1; i <= a.size(); i++) {
+    current[0] = static_cast<int>(i);
+    int rowMin = current[0];
+    for (size_t j = 1; j <= b.size(); j++) {
+      int substitution = previous[j - 1] + (a[i - 1] != b[j - 1]);
+      current[j] = std::min({ previous[j] + 1, current[j - 1] + 1, substitution });
+      rowMin = std::min(rowMin, current[j]);
+    }
+    if (rowMin > bound) return bound + 1;
+    std::swap(previous, current);
+  }
+  return std::min(previous[b.size()], bound + 1);
+}
+
+int editDistance(const std::string& a, const std::string& b, int bound) {
+  const std::string& pattern = a.size() <= b.size() ? a : b;
+  const std::string& text = a.size() <= b.size() ? b : a;
+  if (static_cast<int>(text.size() - pattern.size()) > bound) return bound + 1;
+  if (pattern.empty()) return static_cast<int>(text.size());
+  if (pattern.size() <= 64) return myersDistance(pattern, text, bound);
+  return dynamicDistance(pattern, text, bound);
+}
+
+int fuzzyMaxDistance(const std::string& query) {
+  std::string folded = foldCase(query);
+  size_t length = 0;
+  for (unsigned char c : folded) {
+    if ((c & 0xC0) != 0x80) length++;
+  }
+  if (length <= 4) return 0;
+  if (length <= 10) return 1;
+  if (length <= 20) return 2;
+  return 3;
+}
+
+std::set<std::string> foldedTitles(const CatalogEntry& entry) {
+  std::set<std::string> titles = { foldCase(entry.title), foldCase(entry.english) };
+  for (const auto& synonym : entry.synonyms) {
+    titles.insert(foldCase(synonym));
+  }
+  titles.erase("");
+  return titles;
+}
+
+void updateFuzzyIndex(uint32_t index, const CatalogEntry* previous, const CatalogEntry& entry) {
+  std::set<std::string> titles = foldedTitles(entry);
+  // ingestion refreshes every entry weekly, mostly with the same titles
+  if (previous && foldedTitles(*previous) == titles) return;
+
+  std::unique_lock<std::shared_mutex> lock(fuzzyMtx);
+  // replaced titles leave their postings and free their slot, so refreshes
+  // keep the index at the size of the catalog
+  auto& entryTitles = fuzzyEntryTitles[index];
+  for (uint32_t title : entryTitles) {
+    for (uint32_t gram : trigrams(fuzzyTitles[title].folded)) {
+      auto postings = fuzzyPostings.find(gram);
+      if (postings == fuzzyPostings.end()) continue;
+      auto& ids = postings->second;
+      ids.erase(std::remove(ids.begin(), ids.end(), title), ids.end());
+      if (ids.empty()) fuzzyPostings.erase(postings);
+    }
+    fuzzyTitles[title] = FuzzyTitle{ "", index, false };
+    fuzzyFreeTitles.push_back(title);
+  }
+  entryTitles.clear();
+
+  for (const auto& folded : titles) {
+    uint32_t title;
+    if (!fuzzyFreeTitles.empty()) {
+      title = fuzzyFreeTitles.back();
+      fuzzyFreeTitles.pop_back();
+      fuzzyTitles[title] = FuzzyTitle{ folded, index, true };
+    } else {
+      title = static_cast<uint32_t>(fuzzyTitles.size());
+      fuzzyTitles.push_back(FuzzyTitle{ folded, index, true });
+    }
+    for (uint32_t gram : trigrams(folded)) {
+      fuzzyPostings[gram].push_back(title);
+    }
+    entryTitles.push_back(title);
+  }
+}
+
+std::vector<FuzzyMatch> fuzzyMatch(const std::string& query, int maxDistance, size_t limit) {
+  std::string folded = foldCase(query);
+  if (folded.empty()) return {};
+  std::vector<uint32_t> grams = trigrams(folded);
+  // q-gram lemma: every edit destroys at most three trigrams
+  int threshold = static_cast<int>(grams.size()) - 3 * maxDistance;
+
+  std::unordered_map<uint32_t, FuzzyMatch> best;
+  auto verify = [&](uint32_t title) {
+    const FuzzyTitle& candidate = fuzzyTitles[title];
+    if (!candidate.live) return;
+    int distance = editDistance(folded, candidate.folded, maxDistance);
+    if (distance > maxDistance) return;
+    auto it = best.find(candidate.entry);
+    if (it == best.end() || distance < it->second.distance) {
+      best[candidate.entry] = FuzzyMatch{ candidate.entry, distance, candidate.folded };
+    }
+  };
+
+  std::shared_lock<std::shared_mutex> lock(fuzzyMtx);
+  if (threshold <= 0) {
+    for (uint32_t title = 0; title < fuzzyTitles.size(); title++) {
+      verify(title);
+    }
+  } else {
+    thread_local std::vector<uint16_t> counts;
+    thread_local std::vector<uint32_t> touched;
+    counts.resize(fuzzyTitles.size());
+    for (uint32_t gram : grams) {
+      auto postings = fuzzyPostings.find(gram);
+      if (postings == fuzzyPostings.end()) continue;
+      for (uint32_t title : postings->second) {
+        if (counts[title]++ == 0) touched.push_back(title);
+      }
+    }
+    for (uint32_t title : touched) {
+      if (counts[title] >= threshold) {
+        verify(title);
+      }
+      counts[title] = 0;
+    }
+    touched.clear();
+  }
+  lock.unlock();
+
+  std::vector<FuzzyMatch> matches;
+  matches.reserve(best.size());
+  for (auto& [entry, match] : best) {
+    matches.push_back(std::move(match));
+  }
+  std::sort(matches.begin(), matches.end(), [](const FuzzyMatch& a, const FuzzyMatch& b) {
+    return a.distance != b.distance ? a.distance < b.distance : a.entry < b.entry;
+  });
+  if (matches.size() > limit) matches.resize(limit);
+  return matches;
+}
@@ -0,0 +1,29 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include "catalog.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct FuzzyMatch {
+  uint32_t entry; // catalog index
+  int distance;
+  std::string title; // folded title that matched
+};
+
+// replaces the titles indexed for a catalog entry (previous is null for new entries)
+void updateFuzzyIndex(uint32_t, const CatalogEntry*, const CatalogEntry&);
+
+// typo budget for a guess, from the characters of its folded form so padding
+// and multi-byte characters do not widen it
+int fuzzyMaxDistance(const std::string&);
+
+// catalog titles within the distance of the query, closest first, one per entry
+std::vector<FuzzyMatch> fuzzyMatch(const std::string&, int, size_t);
+
+// Levenshtein distance, or bound + 1 once it is known to exceed bound
+int editDistance(const std::string&, const std::string&, int);
+
+#endif // FUZZY_H
@@ -0,0 +1,131 @@
+#include "guess.h"
+#include "catalog.h"
+#include "similar.h"
+#include "types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// distractors are drawn from the most similar anime so the rounds are not
+// solved by genre or art style alone
+constexpr size_t similarCandidates = 30;
+constexpr size_t mainCharacters = 3;
+
+Json valueJson(const std::string& value) {
+  Json json;
+  json.type = Json::Type::VALUE;
+  json.value = value;
+  return json;
+}
+
+std::string compareValues(int guess, int answer) {
+  if (guess == 0 || answer == 0) return "unknown";
+  if (answer > guess) return "higher";
+  if (answer < guess) return "lower";
+  return "equal";
+}
+
+Json evaluateGuess(const CatalogEntry& guessEntry, const CatalogEntry& answerEntry) {
+  const AnimeFeatures& guess = guessEntry.features;
+  const AnimeFeatures& answer = answerEntry.features;
+
+  Json result;
+  result.type = Json::Type::OBJECT;
+  result.object["correct"] = valueJson(guessEntry.id == answerEntry.id ? "true" : "false");
+
+  int sharedCount = 0;
+  int guessCount = 0;
+  int answerCount = 0;
+  Json shared;
+  shared.type = Json::Type::ARRAY;
+  for (unsigned word = 0; word < maxGenreId / 64; word++) {
+    uint64_t common = guess.genres[word] & answer.genres[word];
+    sharedCount += __builtin_popcountll(common);
+    guessCount += __builtin_popcountll(guess.genres[word]);
+    answerCount += __builtin_popcountll(answer.genres[word]);
+    while (common) {
+      unsigned id = word * 64 + __builtin_ctzll(common);
+      shared.array.push_back(valueJson(getGenreName(id)));
+      common &= common - 1;
+    }
+  }
+  result.object["genres"] = shared;
+  result.object["genresMatch"] = valueJson(
+    sharedCount == answerCount && sharedCount == guessCount ? "exact" : sharedCount > 0 ? "partial" : "none"
+  );
+
+  bool sameStudio = false;
+  for (uint16_t guessStudio : guess.studios) {
+    for (uint16_t answerStudio : answer.studios) {
+      sameStudio |= guessStudio != 0 && guessStudio == answerStudio;
+    }
+  }
+  result.object["studio"] = valueJson(sameStudio ? "true" : "false");
+
+  result.object["season"] = valueJson(compareValues(
+    guess.season ? guess.year * 4 + guess.season : 0,
+    answer.season ? answer.year * 4 + answer.season : 0
+  ));
+  result.object["year"] = valueJson(compareValues(guess.year, answer.year));
+  result.object["episodes"] = valueJson(compareValues(guess.episodes, answer.episodes));
+  result.object["score"] = valueJson(compareValues(guess.score, answer.score));
+  result.object["mediaType"] = valueJson(guess.mediaType && guess.mediaType == answer.mediaType ? "true" : "false");
+  result.object["source"] = valueJson(guess.source && guess.source == answer.source ? "true" : "false");
+  result.object["rating"] = valueJson(guess.rating && guess.rating == answer.rating ? "true" : "false");
+
+  return result;
+}
+
+DailyGuesses createDailyGuesses(uint32_t answerIndex) {
+  DailyGuesses guesses;
+  auto answer = getCatalogEntry(answerIndex);
+  if (!answer) return guesses;
+  std::mt19937 rng{ std::random_device{}() };
+
+  guesses.screenshots = answer->pictures;
+  std::shuffle(guesses.screenshots.begin(), guesses.screenshots.end(), rng);
+  if (guesses.screenshots.size() > guessRounds) guesses.screenshots.resize(guessRounds);
+
+  // main characters first, falling back to the rest of the cast
+  std::vector<uint32_t> answerCharacters = answer->characters;
+  if (answerCharacters.empty()) return guesses;
+  size_t main = std::min(mainCharacters * 2, answerCharacters.size());
+  std::shuffle(answerCharacters.begin(), answerCharacters.begin() + main, rng);
+  std::unordered_set<uint32_t> excluded(answer->characters.begin(), answer->characters.end());
+
+  // sequels share characters with the answer, those cannot be distractors
+  std::vector<std::vector<uint32_t>> pools;
+  for (uint32_t candidate : findSimilarAnime(answerIndex, similarCandidates)) {
+    auto entry = getCatalogEntry(candidate);
+    if (!entry) continue;
+    std::vector<uint32_t> pool;
+    for (size_t i = 0; i < entry->characters.size() && pool.size() < mainCharacters; i++) {
+      if (excluded.find(entry->characters[i]) == excluded.end()) {
+        pool.push_back(entry->characters[i]);
+      }
+    }
+    if (!pool.empty()) pools.push_back(pool);
+  }
+  if (pools.empty()) return guesses;
+  std::shuffle(pools.begin(), pools.end(), rng);
+
+  size_t next = 0;
+  for (size_t round = 0; round < guessRounds && round < answerCharacters.size(); round++) {
+    std::vector<uint32_t> characters = { answerCharacters[round] };
+    std::unordered_set<uint32_t> used(characters.begin(), characters.end());
+    for (size_t tries = 0; characters.size() < charactersPerRound && tries < pools.size(); tries++) {
+      const auto& pool = pools[next++ % pools.size()];
+      uint32_t character = pool[std::uniform_int_distribution<size_t>(0, pool.size() - 1)(rng)];
+      if (used.insert(character).second) {
+        characters.push_back(character);
+      }
+    }
+    std::shuffle(characters.begin(), characters.end(), rng);
+    guesses.characters.push_back(characters);
+  }
+  return guesses;
+}
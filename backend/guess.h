@@ -0,0 +1,26 @@
+#ifndef GUESS_H
+#define GUESS_H
+
+#include "catalog.h"
+#include "types.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// hints for a guessed anime compared with the answer, "higher"/"lower"
+// tell where the answer's value is relative to the guess
+Json evaluateGuess(const CatalogEntry&, const CatalogEntry&);
+
+constexpr size_t guessRounds = 3;
+constexpr size_t charactersPerRound = 4;
+
+struct DailyGuesses {
+  std::vector<std::string> screenshots; // pictures of the answer
+  std::vector<std::vector<uint32_t>> characters; // per round one character of the answer among similar anime's
+};
+
+// built once when a daily is created, empty parts when the answer lacks pictures or characters
+DailyGuesses createDailyGuesses(uint32_t);
+
+#endif // GUESS_H
@@ -1,10 +1,18 @@
 #include "http.h"
 #include "json.h"
 #include "types.h"
-
+#include "trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <iomanip>
 #include <regex>
 #include <sstream>
+#include <stdexcept>
 #include <iostream>
 #include <string>
 
@@ -187,32 +195,136 @@ HttpObject parseRequest(const std::string& raw) {
 }
 
 std::string createRequest(const std::string& host, const HttpObject& request) {
-  return "";
+  std::string methodStr = request.methodStr.empty() ? "GET" : request.methodStr;
+  std::string raw = methodStr + " " + (request.path.empty() ? "/" : request.path);
+  if (!request.queryParams.empty()) {
+    raw += "?";
+    bool first = true;
+    for (const auto& [key, value] : request.queryParams) {
+      if (!first) raw += "&";
+      raw += urlEncode(key) + "=" + urlEncode(value);
+      first = false;
+    }
+  }
+  raw += " HTTP/1.1\r\n";
+  raw += "Host: " + host + "\r\n";
+  for (const auto& [key, value] : request.headers) {
+    if (key == "Host" || key == "Connection" || key == "Content-Length") continue;
+    raw += key + ": " + value + "\r\n";
+  }
+
+  std::string body;
+  if (methodStr == "POST" || methodStr == "PUT") {
+    body = jsonToString(request.body);
+    if (request.headers.find("Content-Type") == request.headers.end()) {
+      raw += "Content-Type: application/json\r\n";
+    }
+    raw += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  raw += "Connection: keep-alive\r\n\r\n";
+  return raw + body;
 }
 
 // !request -------------------------------------------------- !request
 
 // response -------------------------------------------------- response
 
-HttpObject parseResponse(const std::string& raw) {
-  HttpObject request;
-  std::istringstream stream(raw);
-  std::string line;
+std::string decodeChunked(const std::string& raw, size_t pos) {
+  std::string body;
+  while (pos < raw.size()) {
+    size_t lineEnd = raw.find("\r\n", pos);
+    if (lineEnd == std::string::npos) break;
+    size_t size = std::strtoull(raw.c_str() + pos, nullptr, 16);
+    if (size == 0) break;
+    body.append(raw, lineEnd + 2, size);
+    pos = lineEnd + 2 + size + 2;
+  }
+  return body;
+}
 
-  while (std::getline(stream, line) && line != "\r"); // if headers required modify
-  
-  request.body = parseBody(stream);
+std::string findHeader(const std::map<std::string, std::string>& headers, const std::string& name) {
+  for (const auto& [key, value] : headers) {
+    if (key.size() == name.size() && std::equal(key.begin(), key.end(), name.begin(), [](char a, char b) {
+      return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    })) return value;
+  }
+  return "";
+}
 
-  return request;
+// fills status and headers, returns the offset of the body
+size_t parseResponseHead(const std::string& raw, HttpObject& response) {
+  size_t headerEnd = raw.find("\r\n\r\n");
+  if (headerEnd == std::string::npos) {
+    std::cerr << "[http.cpp:parseResponseHead] Incomplete response\n";
+    throw std::runtime_error("Incomplete response");
+  }
+
+  size_t lineEnd = raw.find("\r\n");
+  if (raw.compare(0, 5, "HTTP/") == 0 && lineEnd > 9) {
+    response.status = std::atoi(raw.c_str() + 9);
+  }
+
+  size_t pos = lineEnd + 2;
+  while (pos < headerEnd) {
+    size_t end = raw.find("\r\n", pos);
+    size_t colonPos = raw.find(':', pos);
+    if (colonPos != std::string::npos && colonPos < end) {
+      std::string key = raw.substr(pos, colonPos - pos);
+      std::string value = raw.substr(colonPos + 1, end - colonPos - 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t") + 1);
+      response.headers[key] = value;
+    }
+    pos = end + 2;
+  }
+  return headerEnd + 4;
 }
 
-std::string createResponse(ResponseStatus status, Json body) {
+std::string decodeResponseBody(const std::string& raw, size_t bodyStart, const HttpObject& response) {
+  if (findHeader(response.headers, "Transfer-Encoding").find("chunked") != std::string::npos) {
+    return decodeChunked(raw, bodyStart);
+  }
+  return raw.substr(bodyStart);
+}
+
+std::string getResponseBody(const std::string& raw) {
+  HttpObject response;
+  size_t bodyStart = parseResponseHead(raw, response);
+  return decodeResponseBody(raw, bodyStart, response);
+}
+
+// expects a complete response as returned by sendHttpRequest
+HttpObject parseResponse(const std::string& raw) {
+  HttpObject response;
+  size_t bodyStart = parseResponseHead(raw, response);
+  std::string body = decodeResponseBody(raw, bodyStart, response);
+  response.body.type = Json::Type::VALUE;
+  if (body.find_first_not_of(" \t\r\n") == std::string::npos) return response;
+
+  try {
+    std::istringstream stream(body);
+    response.body = buildJson(stream);
+  } catch (const std::exception& e) {
+    // not json, keep the text as is
+    response.body.type = Json::Type::VALUE;
+    response.body.value = body;
+  }
+  return response;
+}
+
+std::string responseHead(ResponseStatus status) {
   std::string response = "HTTP/1.1 ";
 
   switch (status) {
     case OK:
       response += "200 OK\r\n";
       break;
+    case ACCEPTED:
+      response += "202 Accepted\r\n";
+      break;
+    case NOT_MODIFIED:
+      response += "304 Not Modified\r\n";
+      break;
     case NOT_FOUND:
       response += "404 Not Found\r\n";
       break;
@@ -228,29 +340,103 @@ std::string createResponse(ResponseStatus status, Json body) {
     case CONFLICT:
       response += "409 Conflict\r\n";
       break;
+    case TOO_MANY_REQUESTS:
+      response += "429 Too Many Requests\r\n";
+      break;
     case INTERNAL_SERVER_ERROR:
       response += "500 Internal Server Error\r\n";
       break;
+    case SERVICE_UNAVAILABLE:
+      response += "503 Service Unavailable\r\n";
+      break;
     default:
       response += "500 Internal Server Error\r\n"; // Fallback for unknown status
       break;
   } 
 
   response += "Connection: close\r\n";
+  return response;
+}
 
+void appendCacheHeaders(std::string& response, const CacheMetadata& metadata) {
+  if (!metadata.etag.empty()) {
+    response += "ETag: " + metadata.etag + "\r\n";
+  }
+  if (!metadata.lastModified.empty()) {
+    response += "Last-Modified: " + metadata.lastModified + "\r\n";
+  }
+  if (!metadata.cacheControl.empty()) {
+    response += "Cache-Control: " + metadata.cacheControl + "\r\n";
+  }
+}
+
+std::string createResponse(ResponseStatus status, const std::string& contentType, const std::string& body, const CacheMetadata& metadata) {
+  std::string response = responseHead(status);
+  response.reserve(response.size() + 256 + body.size());
+
+  appendCacheHeaders(response, metadata);
+  response += "Content-Type: " + contentType + "\r\n";
+  response += "Content-Length: " + std::to_string(body.length()) + "\r\n";
+  response += "\r\n";
+  response += body;
+
+  return response;
+}
+
+std::string createResponse(ResponseStatus status, const std::string& contentType, const std::string& body) {
+  return createResponse(status, contentType, body, CacheMetadata{});
+}
+
+std::string createResponse(ResponseStatus status, Json body) {
+  TraceSpan span(TracePhase::CREATE_RESPONSE);
   if (body.type == Json::Type::VALUE) {
-    response += "Content-Type: text/plain\r\n";
-    response += "Content-Length: " + std::to_string(body.value.length()) + "\r\n";
-    response += "\r\n";
-    response += body.value;
-  } else if (body.type == Json::Type::OBJECT) {
-    response += "Content-Type: application/json\r\n";
-    response += "\r\n";
-    response += jsonToString(body);
+    return createResponse(status, "text/plain", body.value);
   }
+  return createResponse(status, "application/json", jsonToString(body));
+}
 
+std::string createNotModifiedResponse(const CacheMetadata& metadata) {
+  std::string response = responseHead(NOT_MODIFIED);
+  appendCacheHeaders(response, metadata);
+  response += "\r\n";
   return response;
 }
 
+// strong validator, FNV-1a over the payload
+std::string computeETag(const std::string& body) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : body) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  char buffer[19];
+  std::snprintf(buffer, sizeof(buffer), "\"%016llx\"", static_cast<unsigned long long>(hash));
+  return buffer;
+}
+
+bool matchesETag(const std::string& ifNoneMatch, const std::string& etag) {
+  std::istringstream stream(ifNoneMatch);
+  std::string candidate;
+  while (std::getline(stream, candidate, ',')) {
+    candidate.erase(0, candidate.find_first_not_of(" \t"));
+    candidate.erase(candidate.find_last_not_of(" \t") + 1);
+    if (candidate.rfind("W/", 0) == 0) {
+      candidate.erase(0, 2);
+    }
+    if (candidate == "*" || candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string httpDate(std::time_t time) {
+  std::tm tm{};
+  gmtime_r(&time, &tm);
+  char buffer[32];
+  std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buffer;
+}
+
 // !response ------------------------------------------------ !response
 
@@ -3,6 +3,7 @@
 
 #include "types.h"
 
+#include <ctime>
 #include <string>
 
 std::string urlDecode(const std::string&);
@@ -13,6 +14,15 @@ HttpObject parseRequest(const std::string&);
 std::string createRequest(const std::string&, const HttpObject&);
 
 HttpObject parseResponse(const std::string&);
+std::string getResponseBody(const std::string&);
+std::string findHeader(const std::map<std::string, std::string>&, const std::string&); // case insensitive, empty if missing
+std::string createResponse(ResponseStatus, const std::string&, const std::string&, const CacheMetadata&);
+std::string createResponse(ResponseStatus, const std::string&, const std::string&);
 std::string createResponse(ResponseStatus, Json);
+std::string createNotModifiedResponse(const CacheMetadata&);
+
+std::string computeETag(const std::string&);
+bool matchesETag(const std::string&, const std::string&);
+std::string httpDate(std::time_t);
 
 #endif // RESPONSE_H
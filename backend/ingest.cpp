@@ -0,0 +1,398 @@
+#include "ingest.h"
+#include "api.h"
+#include "apicache.h"
+#include "catalog.h"
+#include "storage.h"
+#include "types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+
+// the ranking covers every anime a daily can be picked from (hard goes up to 6000)
+constexpr size_t ingestRankingSize = 6000;
+constexpr size_t ingestPageSize = 500;
+constexpr size_t ingestConcurrency = 4;
+constexpr double ingestRequestsPerSecond = 2.0;
+constexpr double ingestBurst = 4.0;
+constexpr size_t ingestBatchSize = 100;
+constexpr auto ingestInterval = std::chrono::hours(6);
+constexpr auto staleAfter = std::chrono::hours(24 * 7);
+constexpr auto rateLimitedPause = std::chrono::seconds(30);
+
+const char* malFields = "id,title,main_picture,alternative_titles,start_date,end_date,synopsis,mean,rank,"
+  "popularity,num_list_users,media_type,status,genres,num_episodes,start_season,source,"
+  "average_episode_duration,rating,pictures,studios";
+
+std::atomic<bool> ingestRunning(false);
+std::mutex ingestMtx;
+std::condition_variable ingestCv;
+std::thread ingestThread;
+
+// shared by the workers of a run so the API sees at most ingestRequestsPerSecond
+class TokenBucket {
+private:
+  std::mutex mtx;
+  std::condition_variable cv;
+  double rate;
+  double burst;
+  double tokens;
+  std::chrono::steady_clock::time_point last;
+
+  void refill() {
+    auto now = std::chrono::steady_clock::now();
+    tokens = std::min(burst, tokens + std::chrono::duration<double>(now - last).count() * rate);
+    last = now;
+  }
+
+public:
+  TokenBucket(double rate, double burst)
+    : rate(rate), burst(burst), tokens(burst), last(std::chrono::steady_clock::now()) {}
+
+  // false when ingestion was stopped while waiting
+  bool acquire() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (ingestRunning) {
+      refill();
+      if (tokens >= 1) {
+        tokens -= 1;
+        return true;
+      }
+      auto wait = std::chrono::duration<double>((1 - tokens) / rate);
+      cv.wait_for(lock, std::min<std::chrono::duration<double>>(wait, std::chrono::seconds(1)));
+    }
+    return false;
+  }
+
+  // drains the bucket so nobody sends anything for the given time
+  void pause(std::chrono::seconds duration) {
+    std::lock_guard<std::mutex> lock(mtx);
+    refill();
+    tokens = std::min(tokens, 0.0) - rate * duration.count();
+  }
+};
+
+// MAL_URL is the API base, only its path is used since the host comes from MAL_HOST
+std::string malPathPrefix() {
+  const char* url = std::getenv("MAL_URL");
+  std::string prefix = url ? url : "";
+  size_t scheme = prefix.find("://");
+  if (scheme != std::string::npos) {
+    size_t path = prefix.find('/', scheme + 3);
+    prefix = path != std::string::npos ? prefix.substr(path) : "";
+  }
+  while (!prefix.empty() && prefix.back() == '/') {
+    prefix.pop_back();
+  }
+  return prefix;
+}
+
+bool fetchMal(TokenBucket& bucket, const std::string& path, const std::map<std::string, std::string>& params, HttpObject& response) {
+  // replaying from the disk cache does not reach the API, only the stop flag matters
+  if (isResponseCacheOffline() ? !ingestRunning : !bucket.acquire()) return false;
+
+  HttpObject request;
+  request.methodStr = "GET";
+  request.path = malPathPrefix() + path;
+  request.queryParams = params;
+  request.headers["X-MAL-CLIENT-ID"] = std::getenv("TOKEN");
+  try {
+    response = malRequest(request);
+  } catch (const std::exception& e) {
+    std::cerr << "[ingest.cpp:fetchMal] " << path << ": " << e.what() << "\n";
+    return false;
+  }
+
+  if (response.status == 429) {
+    std::cerr << "[ingest.cpp:fetchMal] rate limited, pausing for " << rateLimitedPause.count() << "s\n";
+    bucket.pause(rateLimitedPause);
+    return false;
+  }
+  if (response.status != 200) {
+    std::cerr << "[ingest.cpp:fetchMal] " << path << ": status " << response.status << "\n";
+    return false;
+  }
+  return true;
+}
+
+const Json* jsonField(const Json& json, const std::string& key) {
+  if (json.type != Json::Type::OBJECT) return nullptr;
+  auto it = json.object.find(key);
+  if (it == json.object.end()) return nullptr;
+  if (it->second.type == Json::Type::VALUE && it->second.value == "null") return nullptr;
+  return &it->second;
+}
+
+// values of the parsed body are untyped strings, the document types come from the field
+void appendString(bsoncxx::builder::basic::document& doc, const Json& json, const std::string& key) {
+  const Json* value = jsonField(json, key);
+  if (value && value->type == Json::Type::VALUE) {
+    doc.append(bsoncxx::builder::basic::kvp(key, value->value));
+  }
+}
+
+void appendInteger(bsoncxx::builder::basic::document& doc, const Json& json, const std::string& key) {
+  const Json* value = jsonField(json, key);
+  if (!value || value->type != Json::Type::VALUE) return;
+  char* end;
+  long long number = std::strtoll(value->value.c_str(), &end, 10);
+  if (end != value->value.c_str() && *end == '\0') {
+    doc.append(bsoncxx::builder::basic::kvp(key, static_cast<int32_t>(number)));
+  }
+}
+
+void appendDouble(bsoncxx::builder::basic::document& doc, const Json& json, const std::string& key) {
+  const Json* value = jsonField(json, key);
+  if (!value || value->type != Json::Type::VALUE) return;
+  char* end;
+  double number = std::strtod(value->value.c_str(), &end);
+  if (end != value->value.c_str() && *end == '\0') {
+    doc.append(bsoncxx::builder::basic::kvp(key, number));
+  }
+}
+
+void appendPicture(bsoncxx::builder::basic::document& doc, const Json& picture) {
+  appendString(doc, picture, "medium");
+  appendString(doc, picture, "large");
+}
+
+// MAL anime details to the shape stored in the anime collection
+std::optional<bsoncxx::document::value> createAnimeDocument(const Json& details) {
+  using bsoncxx::builder::basic::kvp;
+
+  if (!jsonField(details, "title")) return std::nullopt;
+  bsoncxx::builder::basic::document doc;
+  appendInteger(doc, details, "id");
+  if (!doc.view()["id"]) return std::nullopt;
+  for (const char* key : { "title", "start_date", "end_date", "synopsis", "media_type", "status", "source", "rating" }) {
+    appendString(doc, details, key);
+  }
+  for (const char* key : { "rank", "popularity", "num_list_users", "num_episodes", "average_episode_duration" }) {
+    appendInteger(doc, details, key);
+  }
+  appendDouble(doc, details, "mean");
+
+  if (const Json* picture = jsonField(details, "main_picture")) {
+    bsoncxx::builder::basic::document pictureDoc;
+    appendPicture(pictureDoc, *picture);
+    doc.append(kvp("main_picture", pictureDoc.extract()));
+  }
+
+  if (const Json* alternative = jsonField(details, "alternative_titles")) {
+    bsoncxx::builder::basic::document titles;
+    appendString(titles, *alternative, "en");
+    appendString(titles, *alternative, "ja");
+    const Json* synonyms = jsonField(*alternative, "synonyms");
+    bsoncxx::builder::basic::array synonymArray;
+    if (synonyms && synonyms->type == Json::Type::ARRAY) {
+      for (const auto& synonym : synonyms->array) {
+        if (synonym.type == Json::Type::VALUE) synonymArray.append(synonym.value);
+      }
+    }
+    titles.append(kvp("synonyms", synonymArray.extract()));
+    doc.append(kvp("alternative_titles", titles.extract()));
+  }
+
+  for (const char* key : { "genres", "studios" }) {
+    const Json* named = jsonField(details, key);
+    if (!named || named->type != Json::Type::ARRAY) continue;
+    bsoncxx::builder::basic::array items;
+    for (const auto& item : named->array) {
+      bsoncxx::builder::basic::document itemDoc;
+      appendInteger(itemDoc, item, "id");
+      appendString(itemDoc, item, "name");
+      items.append(itemDoc.extract());
+    }
+    doc.append(kvp(key, items.extract()));
+  }
+
+  if (const Json* season = jsonField(details, "start_season")) {
+    bsoncxx::builder::basic::document seasonDoc;
+    appendInteger(seasonDoc, *season, "year");
+    appendString(seasonDoc, *season, "season");
+    doc.append(kvp("start_season", seasonDoc.extract()));
+  }
+
+  if (const Json* pictures = jsonField(details, "pictures")) {
+    bsoncxx::builder::basic::array items;
+    if (pictures->type == Json::Type::ARRAY) {
+      for (const auto& picture : pictures->array) {
+        bsoncxx::builder::basic::document pictureDoc;
+        appendPicture(pictureDoc, picture);
+        items.append(pictureDoc.extract());
+      }
+    }
+    doc.append(kvp("pictures", items.extract()));
+  }
+
+  doc.append(kvp("updatedAt", bsoncxx::types::b_date(std::chrono::system_clock::now())));
+  return doc.extract();
+}
+
+// ids of the most popular anime, in ranking order
+std::vector<int64_t> fetchRanking(TokenBucket& bucket) {
+  std::vector<int64_t> ids;
+  for (size_t offset = 0; offset < ingestRankingSize && ingestRunning; offset += ingestPageSize) {
+    HttpObject response;
+    if (!fetchMal(bucket, "/anime/ranking", {
+      { "ranking_type", "bypopularity" },
+      { "limit", std::to_string(ingestPageSize) },
+      { "offset", std::to_string(offset) }
+    }, response)) break;
+
+    const Json* data = jsonField(response.body, "data");
+    if (!data || data->type != Json::Type::ARRAY) break;
+    for (const auto& item : data->array) {
+      const Json* node = jsonField(item, "node");
+      const Json* id = node ? jsonField(*node, "id") : nullptr;
+      if (id && id->type == Json::Type::VALUE) {
+        ids.push_back(std::strtoll(id->value.c_str(), nullptr, 10));
+      }
+    }
+    if (data->array.size() < ingestPageSize) break;
+  }
+  return ids;
+}
+
+// upserts by MAL id and pushes the stored documents into the in-memory catalog
+void writeAnime(std::vector<bsoncxx::document::value>& batch, Storage& storage) {
+  for (const auto& anime : storage.upsertAnime(batch)) {
+    try {
+      upsertCatalogEntry(anime.view());
+    } catch (const std::exception& e) {
+      std::cerr << "[ingest.cpp:writeAnime] " << e.what() << "\n";
+    }
+  }
+}
+
+void runIngestion(Storage& storage) {
+  TokenBucket bucket(ingestRequestsPerSecond, ingestBurst);
+  std::vector<int64_t> ranking = fetchRanking(bucket);
+  std::unordered_map<int64_t, int64_t> updatedAt = storage.findAnimeUpdates();
+
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+  int64_t staleBefore = now - std::chrono::duration_cast<std::chrono::milliseconds>(staleAfter).count();
+  std::deque<int64_t> pending;
+  for (int64_t id : ranking) {
+    auto updated = updatedAt.find(id);
+    if (updated == updatedAt.end() || updated->second < staleBefore) {
+      pending.push_back(id);
+    }
+  }
+  std::cout << "Ingestion: " << ranking.size() << " ranked, " << pending.size() << " stale\n";
+  if (pending.empty()) return;
+
+  // workers fetch details, this thread writes what they produce in batches
+  std::mutex resultsMtx;
+  std::condition_variable resultsCv;
+  std::vector<bsoncxx::document::value> results;
+  size_t active = ingestConcurrency;
+
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < ingestConcurrency; i++) {
+    workers.emplace_back([&] {
+      while (true) {
+        int64_t id;
+        {
+          std::lock_guard<std::mutex> lock(resultsMtx);
+          if (pending.empty() || !ingestRunning) break;
+          id = pending.front();
+          pending.pop_front();
+        }
+        HttpObject response;
+        if (!fetchMal(bucket, "/anime/" + std::to_string(id), { { "fields", malFields } }, response)) continue;
+        auto anime = createAnimeDocument(response.body);
+        if (!anime) continue;
+
+        std::lock_guard<std::mutex> lock(resultsMtx);
+        results.push_back(std::move(*anime));
+        if (results.size() >= ingestBatchSize) {
+          resultsCv.notify_one();
+        }
+      }
+      std::lock_guard<std::mutex> lock(resultsMtx);
+      active--;
+      resultsCv.notify_one();
+    });
+  }
+
+  size_t written = 0;
+  while (true) {
+    std::vector<bsoncxx::document::value> batch;
+    bool done;
+    {
+      std::unique_lock<std::mutex> lock(resultsMtx);
+      resultsCv.wait_for(lock, std::chrono::seconds(1), [&] {
+        return results.size() >= ingestBatchSize || active == 0;
+      });
+      batch.swap(results);
+      done = active == 0;
+    }
+    if (!batch.empty()) {
+      try {
+        writeAnime(batch, storage);
+        written += batch.size();
+      } catch (const std::exception& e) {
+        // not marked as updated, they are picked up again by the next run
+        std::cerr << "[ingest.cpp:runIngestion] " << batch.size() << " anime not written: " << e.what() << "\n";
+      }
+    }
+    if (done) break;
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::cout << "Ingestion: " << written << " anime refreshed\n";
+}
+
+void ingestLoop(Storage& storage) {
+  while (ingestRunning) {
+    try {
+      runIngestion(storage);
+    } catch (const std::exception& e) {
+      std::cerr << "[ingest.cpp:ingestLoop] " << e.what() << "\n";
+    }
+    std::unique_lock<std::mutex> lock(ingestMtx);
+    ingestCv.wait_for(lock, ingestInterval, [] { return !ingestRunning; });
+  }
+}
+
+void startIngestion(Storage& storage) {
+  if (!std::getenv("MAL_HOST") || !std::getenv("TOKEN")) {
+    std::cout << "MAL_HOST or TOKEN not set, catalog ingestion disabled\n";
+    return;
+  }
+  ingestRunning = true;
+  ingestThread = std::thread(ingestLoop, std::ref(storage));
+}
+
+void stopIngestion() {
+  {
+    std::lock_guard<std::mutex> lock(ingestMtx);
+    ingestRunning = false;
+  }
+  ingestCv.notify_all();
+  if (ingestThread.joinable()) {
+    ingestThread.join();
+  }
+}
@@ -0,0 +1,11 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+class Storage;
+
+// background refresh of the anime collection from the MAL API, entries not
+// updated for a week are fetched again and upserted into the catalog
+void startIngestion(Storage&);
+void stopIngestion();
+
+#endif // INGEST_H
@@ -0,0 +1,312 @@
+#include "leaderboard.h"
+#include "day.h"
+#include "scores.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+constexpr int leaderboardRetentionDays = 30;
+
+struct LeaderboardKey {
+  int points;
+  int64_t at; // time of the last score, earlier ranks first on equal points
+  std::string username;
+
+  bool operator<(const LeaderboardKey& other) const {
+    if (points != other.points) return points > other.points;
+    if (at != other.at) return at < other.at;
+    return username < other.username;
+  }
+  bool operator==(const LeaderboardKey& other) const {
+    return points == other.points && at == other.at && username == other.username;
+  }
+};
+
+// skip list where every link stores how many nodes it spans, giving
+// O(log n) insert, erase and rank
+class RankedSkipList {
+private:
+  static constexpr int maxLevel = 24;
+
+  struct Node {
+    LeaderboardKey key;
+    Node* next[maxLevel] = {};
+    size_t span[maxLevel] = {};
+  };
+
+  Node head;
+  int level = 1;
+  size_t length = 0;
+  std::mt19937 rng{ std::random_device{}() };
+
+  int randomLevel() {
+    int lvl = 1;
+    while (lvl < maxLevel && (rng() & 3) == 0) {
+      lvl++;
+    }
+    return lvl;
+  }
+
+public:
+  RankedSkipList() = default;
+  RankedSkipList(const RankedSkipList&) = delete;
+  RankedSkipList& operator=(const RankedSkipList&) = delete;
+  ~RankedSkipList() { clear(); }
+
+  size_t size() const { return length; }
+
+  void clear() {
+    Node* node = head.next[0];
+    while (node) {
+      Node* next = node->next[0];
+      delete node;
+      node = next;
+    }
+    head = Node{};
+    level = 1;
+    length = 0;
+  }
+
+  void insert(const LeaderboardKey& key) {
+    Node* update[maxLevel];
+    size_t rank[maxLevel];
+    Node* x = &head;
+    for (int i = level - 1; i >= 0; i--) {
+      rank[i] = i == level - 1 ? 0 : rank[i + 1];
+      while (x->next[i] && x->next[i]->key < key) {
+        rank[i] += x->span[i];
+        x = x->next[i];
+      }
+      update[i] = x;
+    }
+
+    int lvl = randomLevel();
+    if (lvl > level) {
+      for (int i = level; i < lvl; i++) {
+        rank[i] = 0;
+        update[i] = &head;
+        head.span[i] = length;
+      }
+      level = lvl;
+    }
+
+    Node* node = new Node{ key };
+    for (int i = 0; i < lvl; i++) {
+      node->next[i] = update[i]->next[i];
+      update[i]->next[i] = node;
+      node->span[i] = update[i]->span[i] - (rank[0] - rank[i]);
+      update[i]->span[i] = (rank[0] - rank[i]) + 1;
+    }
+    for (int i = lvl; i < level; i++) {
+      update[i]->span[i]++;
+    }
+    length++;
+  }
+
+  bool erase(const LeaderboardKey& key) {
+    Node* update[maxLevel];
+    Node* x = &head;
+    for (int i = level - 1; i >= 0; i--) {
+      while (x->next[i] && x->next[i]->key < key) {
+        x = x->next[i];
+      }
+      update[i] = x;
+    }
+    x = x->next[0];
+    if (!x || !(x->key == key)) return false;
+
+    for (int i = 0; i < level; i++) {
+      if (update[i]->next[i] == x) {
+        update[i]->span[i] += x->span[i] - 1;
+        update[i]->next[i] = x->next[i];
+      } else {
+        update[i]->span[i]--;
+      }
+    }
+    while (level > 1 && !head.next[level - 1]) {
+      level--;
+    }
+    length--;
+    delete x;
+    return true;
+  }
+
+  // 1 based, 0 when missing
+  size_t rank(const LeaderboardKey& key) const {
+    size_t rank = 0;
+    const Node* x = &head;
+    for (int i = level - 1; i >= 0; i--) {
+      while (x->next[i] && !(key < x->next[i]->key)) {
+        rank += x->span[i];
+        x = x->next[i];
+      }
+      if (x != &head && x->key == key) return rank;
+    }
+    return 0;
+  }
+
+  std::vector<LeaderboardKey> top(size_t count) const {
+    std::vector<LeaderboardKey> keys;
+    keys.reserve(std::min(count, length));
+    for (const Node* x = head.next[0]; x && keys.size() < count; x = x->next[0]) {
+      keys.push_back(x->key);
+    }
+    return keys;
+  }
+};
+
+// past days are compacted into a sorted vector, only the current day keeps a skip list
+struct DayBoard {
+  RankedSkipList live;
+  std::vector<LeaderboardKey> compacted;
+  bool isCompacted = false;
+  std::unordered_map<std::string, LeaderboardKey> keys; // username -> current key
+  std::unordered_map<std::string, int> scoreCounts; // username -> scores summed into the key
+};
+
+std::shared_mutex leaderboardMtx;
+std::map<Day, std::unique_ptr<DayBoard>> leaderboards;
+
+void compactLeaderboards(Day latest) {
+  while (!leaderboards.empty() && leaderboards.begin()->first < latest - leaderboardRetentionDays) {
+    leaderboards.erase(leaderboards.begin());
+  }
+  for (auto& [day, board] : leaderboards) {
+    if (day >= latest || board->isCompacted) continue;
+    board->compacted = board->live.top(board->live.size());
+    board->live.clear();
+    board->isCompacted = true;
+  }
+}
+
+// back to a skip list so the board can change
+void expandLeaderboard(DayBoard& board) {
+  if (!board.isCompacted) return;
+  for (const auto& key : board.compacted) {
+    board.live.insert(key);
+  }
+  board.compacted.clear();
+  board.isCompacted = false;
+}
+
+void recordLeaderboardScore(Day day, const std::string& username, int points, int64_t at) {
+  std::unique_lock<std::shared_mutex> lock(leaderboardMtx);
+  if (!leaderboards.empty() && day < leaderboards.rbegin()->first - leaderboardRetentionDays) return;
+
+  bool newDay = leaderboards.empty() || day > leaderboards.rbegin()->first;
+  auto& board = leaderboards[day];
+  if (!board) {
+    board = std::make_unique<DayBoard>();
+  }
+  if (newDay) {
+    compactLeaderboards(day);
+  }
+  expandLeaderboard(*board);
+
+  board->scoreCounts[username]++;
+  LeaderboardKey key{ points, at, username };
+  auto previous = board->keys.find(username);
+  if (previous != board->keys.end()) {
+    board->live.erase(previous->second);
+    key.points += previous->second.points;
+    key.at = std::max(key.at, previous->second.at);
+    previous->second = key;
+  } else {
+    board->keys.emplace(username, key);
+  }
+  board->live.insert(key);
+}
+
+void removeLeaderboardScore(Day day, const std::string& username, int points) {
+  std::unique_lock<std::shared_mutex> lock(leaderboardMtx);
+  auto it = leaderboards.find(day);
+  if (it == leaderboards.end()) return;
+  DayBoard& board = *it->second;
+  auto previous = board.keys.find(username);
+  if (previous == board.keys.end()) return;
+
+  bool wasCompacted = board.isCompacted;
+  expandLeaderboard(board);
+  board.live.erase(previous->second);
+  if (--board.scoreCounts[username] <= 0) {
+    board.scoreCounts.erase(username);
+    board.keys.erase(previous);
+  } else {
+    previous->second.points -= points;
+    board.live.insert(previous->second);
+  }
+  if (wasCompacted) {
+    board.compacted = board.live.top(board.live.size());
+    board.live.clear();
+    board.isCompacted = true;
+  }
+}
+
+std::vector<LeaderboardEntry> getLeaderboardTop(Day day, size_t count) {
+  std::shared_lock<std::shared_mutex> lock(leaderboardMtx);
+  auto it = leaderboards.find(day);
+  if (it == leaderboards.end()) return {};
+  const DayBoard& board = *it->second;
+
+  std::vector<LeaderboardKey> keys;
+  if (board.isCompacted) {
+    keys.assign(board.compacted.begin(), board.compacted.begin() + std::min(count, board.compacted.size()));
+  } else {
+    keys = board.live.top(count);
+  }
+
+  std::vector<LeaderboardEntry> entries;
+  entries.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    entries.push_back(LeaderboardEntry{ i + 1, keys[i].username, keys[i].points });
+  }
+  return entries;
+}
+
+bool getLeaderboardRank(Day day, const std::string& username, LeaderboardEntry& entry) {
+  std::shared_lock<std::shared_mutex> lock(leaderboardMtx);
+  auto it = leaderboards.find(day);
+  if (it == leaderboards.end()) return false;
+  const DayBoard& board = *it->second;
+  auto key = board.keys.find(username);
+  if (key == board.keys.end()) return false;
+
+  if (board.isCompacted) {
+    auto position = std::lower_bound(board.compacted.begin(), board.compacted.end(), key->second);
+    entry.rank = static_cast<size_t>(position - board.compacted.begin()) + 1;
+  } else {
+    entry.rank = board.live.rank(key->second);
+  }
+  entry.username = username;
+  entry.points = key->second.points;
+  return entry.rank != 0;
+}
+
+size_t getLeaderboardSize(Day day) {
+  std::shared_lock<std::shared_mutex> lock(leaderboardMtx);
+  auto it = leaderboards.find(day);
+  return it != leaderboards.end() ? it->second->keys.size() : 0;
+}
+
+void loadLeaderboards(Storage& storage, Day today) {
+  size_t count = 0;
+  for (const auto& score : storage.findScores(today - leaderboardRetentionDays)) {
+    recordLeaderboardScore(score.day, score.username, score.points, score.submittedAt);
+    restoreSubmittedScore(score.day, score.key);
+    count++;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(leaderboardMtx);
+  compactLeaderboards(today);
+  std::cout << "Loaded " << count << " scores into the leaderboards\n";
+}
@@ -0,0 +1,30 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include "day.h"
+#include "storage.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct LeaderboardEntry {
+  size_t rank; // 1 based
+  std::string username;
+  int points;
+};
+
+// adds points to the user's total for the day
+void recordLeaderboardScore(Day, const std::string&, int, int64_t);
+// takes back a recorded score that was never stored, a user whose only
+// score it was leaves the board
+void removeLeaderboardScore(Day, const std::string&, int);
+
+std::vector<LeaderboardEntry> getLeaderboardTop(Day, size_t);
+bool getLeaderboardRank(Day, const std::string&, LeaderboardEntry&);
+size_t getLeaderboardSize(Day);
+
+// rebuilds the boards of the retained days from the scores collection
+void loadLeaderboards(Storage&, Day);
+
+#endif // LEADERBOARD_H
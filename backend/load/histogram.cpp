@@ -0,0 +1,69 @@
+#include "load.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+constexpr int exactBits = 7; // values below 128us get their own bucket
+constexpr int subBucketBits = 6;
+constexpr int maxExponent = 40; // ~12 days in microseconds, anything above is clamped
+constexpr size_t bucketCount = (size_t(1) << exactBits) + (maxExponent - exactBits + 1) * (size_t(1) << subBucketBits);
+
+size_t latencyBucketOf(int64_t us) {
+  uint64_t value = us < 0 ? 0 : static_cast<uint64_t>(us);
+  if (value < (uint64_t(1) << exactBits)) return value;
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent > maxExponent) return bucketCount - 1;
+  size_t sub = (value >> (exponent - subBucketBits)) & ((size_t(1) << subBucketBits) - 1);
+  return (size_t(1) << exactBits) + (exponent - exactBits) * (size_t(1) << subBucketBits) + sub;
+}
+
+// largest value that lands in the bucket
+int64_t latencyBucketUpperBound(size_t bucket) {
+  if (bucket < (size_t(1) << exactBits)) return static_cast<int64_t>(bucket);
+  size_t offset = bucket - (size_t(1) << exactBits);
+  int exponent = exactBits + static_cast<int>(offset >> subBucketBits);
+  uint64_t sub = offset & ((size_t(1) << subBucketBits) - 1);
+  uint64_t lower = (uint64_t(1) << exponent) | (sub << (exponent - subBucketBits));
+  return static_cast<int64_t>(lower + (uint64_t(1) << (exponent - subBucketBits)) - 1);
+}
+
+LatencyHistogram::LatencyHistogram() : counts(bucketCount, 0) {}
+
+void LatencyHistogram::record(int64_t us) {
+  counts[latencyBucketOf(us)]++;
+  total++;
+  minUs = std::min(minUs, us);
+  maxUs = std::max(maxUs, us);
+  sumUs += us;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  for (size_t i = 0; i < bucketCount; i++) {
+    counts[i] += other.counts[i];
+  }
+  total += other.total;
+  minUs = std::min(minUs, other.minUs);
+  maxUs = std::max(maxUs, other.maxUs);
+  sumUs += other.sumUs;
+}
+
+int64_t LatencyHistogram::percentile(double quantile) const {
+  if (total == 0) return 0;
+  uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * total)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucketCount; i++) {
+    seen += counts[i];
+    if (seen >= rank) return std::min(latencyBucketUpperBound(i), maxUs);
+  }
+  return maxUs;
+}
+
+void RouteStats::merge(const RouteStats& other) {
+  latency.merge(other.latency);
+  service.merge(other.service);
+  transportErrors += other.transportErrors;
+  for (const auto& [status, count] : other.statuses) {
+    statuses[status] += count;
+  }
+}
@@ -0,0 +1,251 @@
+#include "load.h"
+#include "client.h"
+#include "http.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// drives a running server with a generated mix or a replayed trace and prints
+// one JSON line per route. Open loop sends on a fixed schedule and measures
+// from the scheduled time, so a stalled server is charged for the requests
+// queued behind it instead of slowing the client down (coordinated omission).
+// Closed loop keeps a fixed number of requests in flight.
+
+using Clock = std::chrono::steady_clock;
+
+std::string target = "127.0.0.1:8080";
+std::string hostHeader;
+std::string mix = "login=1,validate=60,refresh=4,daily=35";
+std::string tracePath;
+double rate = 0;
+bool closedLoop = false;
+size_t concurrency = 16;
+double durationSeconds = 30;
+double warmupSeconds = 0;
+double speed = 1;
+uint64_t seed = 1;
+// the user of fixtures/seed.jsonl, clients send the hex SHA-256 of the password
+Credentials credentials = { "loadtest", "823938033bec9a33a44aa40618f9d5e31ccf5625754870bc3f95510d8cbba0b0" };
+
+std::atomic<uint64_t> nextRequest(0);
+
+int64_t microsecondsBetween(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+}
+
+// "HTTP/1.1 200 ...", 0 when malformed
+int statusOf(const std::string& response) {
+  return response.size() > 12 ? std::atoi(response.c_str() + 9) : 0;
+}
+
+bool needsToken(const Workload& workload) {
+  for (const auto& request : workload.templates) {
+    if (request.authorized || request.body.find("{token}") != std::string::npos) return true;
+  }
+  return false;
+}
+
+std::string login() {
+  Workload workload = createMixWorkload("login");
+  std::string response = sendHttpRequest(target, renderRequest(workload.templates[0], hostHeader, credentials, ""));
+  if (statusOf(response) != 200) {
+    std::cerr << "[load.cpp:login] " << credentials.username << ": status " << statusOf(response) << "\n";
+    throw std::runtime_error("Login failed");
+  }
+  return getResponseBody(response);
+}
+
+struct WorkerResult {
+  std::vector<RouteStats> routes;
+  Clock::time_point lastDone;
+};
+
+void runWorker(const Workload& workload, const std::string& token, Clock::time_point start,
+               Clock::time_point measureFrom, Clock::time_point end, WorkerResult& result) {
+  bool openLoop = !closedLoop;
+  while (true) {
+    uint64_t i = nextRequest.fetch_add(1, std::memory_order_relaxed);
+    if (workload.trace && i >= workload.templates.size()) break;
+    const LoadRequest& request = workloadRequest(workload, seed, i);
+
+    Clock::time_point intended;
+    if (openLoop) {
+      intended = start + std::chrono::nanoseconds(workload.trace
+        ? std::llround(request.offsetUs * 1000 / speed)
+        : std::llround(i * 1e9 / rate));
+      if (!workload.trace && intended >= end) break;
+      std::this_thread::sleep_until(intended);
+    } else {
+      intended = Clock::now();
+      if (!workload.trace && intended >= end) break;
+    }
+
+    std::string raw = renderRequest(request, hostHeader, credentials, token);
+    Clock::time_point sent = Clock::now();
+    int status = -1;
+    try {
+      status = statusOf(sendHttpRequest(target, raw));
+    } catch (const std::exception&) {
+      // already logged by the client
+    }
+    Clock::time_point done = Clock::now();
+    if (intended < measureFrom) continue;
+
+    RouteStats& stats = result.routes[request.route];
+    result.lastDone = std::max(result.lastDone, done);
+    if (status < 0) {
+      stats.transportErrors++;
+      continue;
+    }
+    stats.statuses[status]++;
+    stats.latency.record(microsecondsBetween(intended, done));
+    stats.service.record(microsecondsBetween(sent, done));
+  }
+}
+
+void printRouteStats(const std::string& route, const RouteStats& stats, double seconds) {
+  uint64_t responses = 0;
+  uint64_t errors = stats.transportErrors;
+  std::string statuses;
+  for (const auto& [status, count] : stats.statuses) {
+    responses += count;
+    if (status < 200 || status >= 400) errors += count;
+    if (!statuses.empty()) statuses += ",";
+    statuses += "\"" + std::to_string(status) + "\":" + std::to_string(count);
+  }
+  uint64_t requests = responses + stats.transportErrors;
+
+  const LatencyHistogram& latency = stats.latency;
+  char line[1024];
+  std::snprintf(line, sizeof(line),
+    "{\"route\":\"%s\",\"mode\":\"%s\",\"requests\":%llu,\"errors\":%llu,\"transport_errors\":%llu,"
+    "\"throughput\":%.1f,\"mean_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,"
+    "\"max_ms\":%.3f,\"service_p50_ms\":%.3f,\"service_p99_ms\":%.3f,\"status\":{%s}}",
+    route.c_str(), closedLoop ? "closed" : "open",
+    static_cast<unsigned long long>(requests), static_cast<unsigned long long>(errors),
+    static_cast<unsigned long long>(stats.transportErrors),
+    seconds > 0 ? requests / seconds : 0, latency.mean() / 1000,
+    latency.percentile(0.5) / 1000.0, latency.percentile(0.9) / 1000.0, latency.percentile(0.99) / 1000.0,
+    latency.percentile(0.999) / 1000.0, latency.max() / 1000.0,
+    stats.service.percentile(0.5) / 1000.0, stats.service.percentile(0.99) / 1000.0, statuses.c_str());
+  std::cout << line << std::endl;
+}
+
+void printUsage(const char* name) {
+  std::cerr << "usage: " << name << " [--target host:port] [--host header] [--rate rps | --closed]\n"
+            << "  [--concurrency 16] [--duration 30] [--warmup 0] [--mix login=1,validate=60,refresh=4,daily=35]\n"
+            << "  [--trace file.jsonl] [--speed 1] [--seed 1] [--username loadtest] [--password hex]\n";
+}
+
+int main(int argc, char** argv) {
+  try {
+    for (int i = 1; i < argc; i++) {
+      std::string arg(argv[i]);
+      bool hasValue = i + 1 < argc;
+      if (arg == "--target" && hasValue) {
+        target = argv[++i];
+      } else if (arg == "--host" && hasValue) {
+        hostHeader = argv[++i];
+      } else if (arg == "--rate" && hasValue) {
+        rate = std::stod(argv[++i]);
+      } else if (arg == "--closed") {
+        closedLoop = true;
+      } else if (arg == "--concurrency" && hasValue) {
+        concurrency = std::max(1ul, std::stoul(argv[++i]));
+      } else if (arg == "--duration" && hasValue) {
+        durationSeconds = std::stod(argv[++i]);
+      } else if (arg == "--warmup" && hasValue) {
+        warmupSeconds = std::stod(argv[++i]);
+      } else if (arg == "--mix" && hasValue) {
+        mix = argv[++i];
+      } else if (arg == "--trace" && hasValue) {
+        tracePath = argv[++i];
+      } else if (arg == "--speed" && hasValue) {
+        speed = std::stod(argv[++i]);
+      } else if (arg == "--seed" && hasValue) {
+        seed = std::stoull(argv[++i]);
+      } else if (arg == "--username" && hasValue) {
+        credentials.username = argv[++i];
+      } else if (arg == "--password" && hasValue) {
+        credentials.password = argv[++i];
+      } else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    }
+  } catch (const std::exception&) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  // the server ties tokens to the client address through the Host header, so
+  // refresh only succeeds when the target is given as the address the server sees
+  if (hostHeader.empty()) {
+    hostHeader = target.substr(0, target.rfind(':'));
+  }
+  // a generated mix without a rate has no schedule to keep
+  if (tracePath.empty() && !(rate > 0)) closedLoop = true;
+  if (!(speed > 0)) speed = 1;
+
+  Workload workload;
+  std::string token;
+  try {
+    workload = tracePath.empty() ? createMixWorkload(mix) : readTraceWorkload(tracePath);
+    if (needsToken(workload)) token = login();
+  } catch (const std::exception& e) {
+    std::cerr << "[load.cpp:main] " << e.what() << "\n";
+    return 1;
+  }
+
+  // one kept-alive connection per worker when the server allows it
+  setMaxIdleConnections(concurrency);
+
+  std::cerr << "Load: " << target << ", " << (closedLoop ? "closed" : "open") << " loop, "
+            << concurrency << " workers";
+  if (!closedLoop && !workload.trace) std::cerr << ", " << rate << " rps";
+  std::cerr << "\n";
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point measureFrom = start + std::chrono::microseconds(std::llround(warmupSeconds * 1e6));
+  Clock::time_point end = start + std::chrono::microseconds(std::llround((warmupSeconds + durationSeconds) * 1e6));
+
+  std::vector<WorkerResult> results(concurrency);
+  std::vector<std::thread> workers;
+  for (auto& result : results) {
+    result.routes.resize(workload.routes.size());
+    result.lastDone = measureFrom;
+    workers.emplace_back(runWorker, std::cref(workload), std::cref(token), start, measureFrom, end, std::ref(result));
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  closeIdleConnections();
+
+  Clock::time_point lastDone = measureFrom;
+  std::vector<RouteStats> routes(workload.routes.size());
+  RouteStats all;
+  for (const auto& result : results) {
+    lastDone = std::max(lastDone, result.lastDone);
+    for (size_t route = 0; route < routes.size(); route++) {
+      routes[route].merge(result.routes[route]);
+      all.merge(result.routes[route]);
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(lastDone - measureFrom).count();
+  for (size_t route = 0; route < routes.size(); route++) {
+    printRouteStats(workload.routes[route], routes[route], seconds);
+  }
+  printRouteStats("all", all, seconds);
+  return 0;
+}
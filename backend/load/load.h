@@ -0,0 +1,76 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a request of the workload, "{username}", "{password}" and "{token}" in the
+// body are filled in when it is sent
+struct LoadRequest {
+  size_t route = 0; // index into the route names of the workload
+  std::string method;
+  std::string target; // path and query
+  std::string body;
+  bool authorized = false; // sends the session token as a bearer
+  int64_t offsetUs = 0; // send time from the start of a trace
+};
+
+struct Workload {
+  std::vector<std::string> routes;
+  std::vector<double> weights; // generated mixes only, one per route
+  std::vector<LoadRequest> templates; // one per route for a mix, every request of a trace
+  bool trace = false;
+};
+
+// "login=1,validate=60,refresh=4,daily=35", routes are login, validate, refresh and daily
+Workload createMixWorkload(const std::string&);
+// JSON lines of { "at_ms": 12.5, "method": "GET", "target": "/daily", "body": "...", "auth": false }
+// where the route label is the first path segment; malformed lines are skipped
+Workload readTraceWorkload(const std::string&);
+// request i of the workload, mixes pick routes from a hash of the seed and i
+const LoadRequest& workloadRequest(const Workload&, uint64_t, uint64_t);
+
+struct Credentials {
+  std::string username;
+  std::string password;
+};
+
+// raw HTTP/1.1 request with the placeholders of the body filled in
+std::string renderRequest(const LoadRequest&, const std::string&, const Credentials&, const std::string&);
+
+// log-linear buckets over microseconds, exact below 128us then 64 buckets per
+// power of two (~1.6% error), so per-thread histograms merge by adding counts
+class LatencyHistogram {
+private:
+  std::vector<uint64_t> counts;
+  uint64_t total = 0;
+  int64_t minUs = INT64_MAX;
+  int64_t maxUs = 0;
+  double sumUs = 0;
+
+public:
+  LatencyHistogram();
+  void record(int64_t);
+  void merge(const LatencyHistogram&);
+  uint64_t count() const { return total; }
+  int64_t max() const { return total ? maxUs : 0; }
+  int64_t min() const { return total ? minUs : 0; }
+  double mean() const { return total ? sumUs / total : 0; }
+  // upper bound of the bucket holding the quantile, in microseconds
+  int64_t percentile(double) const;
+};
+
+struct RouteStats {
+  LatencyHistogram latency; // from the intended send time, includes waiting for a connection
+  LatencyHistogram service; // from the actual send time
+  uint64_t transportErrors = 0;
+  std::map<int, uint64_t> statuses;
+
+  void merge(const RouteStats&);
+};
+
+#endif // LOAD_H
@@ -0,0 +1,163 @@
+#include "load.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <bsoncxx/json.hpp>
+
+LoadRequest createMixRequest(const std::string& route) {
+  LoadRequest request;
+  if (route == "login") {
+    request.method = "POST";
+    request.target = "/login";
+    request.body = "{\"username\":\"{username}\",\"password\":\"{password}\"}";
+  } else if (route == "validate") {
+    request.method = "POST";
+    request.target = "/validate";
+    request.authorized = true;
+  } else if (route == "refresh") {
+    request.method = "POST";
+    request.target = "/refresh";
+    request.body = "{\"username\":\"{username}\"}";
+    request.authorized = true;
+  } else if (route == "daily") {
+    request.method = "GET";
+    request.target = "/daily";
+  } else {
+    std::cerr << "[workload.cpp:createMixRequest] unknown route " << route << "\n";
+    throw std::runtime_error("Unknown route in mix");
+  }
+  return request;
+}
+
+Workload createMixWorkload(const std::string& mix) {
+  Workload workload;
+  std::istringstream stream(mix);
+  std::string entry;
+  while (std::getline(stream, entry, ',')) {
+    size_t equals = entry.find('=');
+    std::string route = entry.substr(0, equals);
+    double weight = equals == std::string::npos ? 1 : std::strtod(entry.c_str() + equals + 1, nullptr);
+    if (!(weight > 0)) continue;
+
+    LoadRequest request = createMixRequest(route);
+    request.route = workload.routes.size();
+    workload.routes.push_back(route);
+    workload.weights.push_back(weight);
+    workload.templates.push_back(request);
+  }
+  if (workload.routes.empty()) {
+    throw std::runtime_error("Empty mix");
+  }
+  return workload;
+}
+
+// "/daily?day=2024-01-01" gives "daily", "/" gives ""
+std::string routeOf(const std::string& target) {
+  size_t start = target.find_first_not_of('/');
+  if (start == std::string::npos) return "";
+  size_t end = target.find_first_of("/?", start);
+  return target.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+Workload readTraceWorkload(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "[workload.cpp:readTraceWorkload] cannot open " << path << "\n";
+    throw std::runtime_error("Cannot open trace");
+  }
+
+  Workload workload;
+  workload.trace = true;
+  std::string line;
+  size_t number = 0;
+  size_t skipped = 0;
+  while (std::getline(file, line)) {
+    number++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    try {
+      auto document = bsoncxx::from_json(line);
+      auto entry = document.view();
+      LoadRequest request;
+      request.method = std::string(entry["method"].get_string().value);
+      request.target = std::string(entry["target"].get_string().value);
+      if (entry["body"]) request.body = std::string(entry["body"].get_string().value);
+      if (entry["auth"]) request.authorized = entry["auth"].get_bool().value;
+
+      auto at = entry["at_ms"];
+      double atMs = at.type() == bsoncxx::type::k_double ? at.get_double().value
+        : at.type() == bsoncxx::type::k_int64 ? at.get_int64().value : at.get_int32().value;
+      request.offsetUs = std::llround(atMs * 1000);
+
+      std::string route = routeOf(request.target);
+      size_t index = 0;
+      while (index < workload.routes.size() && workload.routes[index] != route) index++;
+      if (index == workload.routes.size()) workload.routes.push_back(route);
+      request.route = index;
+      workload.templates.push_back(std::move(request));
+    } catch (const std::exception& e) {
+      std::cerr << "[workload.cpp:readTraceWorkload] " << path << ":" << number << ": " << e.what() << "\n";
+      skipped++;
+    }
+  }
+  if (workload.templates.empty()) {
+    throw std::runtime_error("Empty trace");
+  }
+  std::cerr << "Trace: " << workload.templates.size() << " requests, " << skipped << " skipped\n";
+  return workload;
+}
+
+// splitmix64, the mix of a run only depends on the seed
+uint64_t mixHash(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+const LoadRequest& workloadRequest(const Workload& workload, uint64_t seed, uint64_t i) {
+  if (workload.trace) return workload.templates[i % workload.templates.size()];
+
+  double total = 0;
+  for (double weight : workload.weights) total += weight;
+  double pick = static_cast<double>(mixHash(seed ^ mixHash(i)) >> 11) / 9007199254740992.0 * total;
+  for (size_t route = 0; route + 1 < workload.weights.size(); route++) {
+    if (pick < workload.weights[route]) return workload.templates[route];
+    pick -= workload.weights[route];
+  }
+  return workload.templates.back();
+}
+
+void replaceAll(std::string& text, const std::string& from, const std::string& to) {
+  for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size())) {
+    text.replace(pos, from.size(), to);
+  }
+}
+
+std::string renderRequest(const LoadRequest& request, const std::string& host, const Credentials& credentials, const std::string& token) {
+  std::string body = request.body;
+  replaceAll(body, "{username}", credentials.username);
+  replaceAll(body, "{password}", credentials.password);
+  replaceAll(body, "{token}", token);
+
+  std::string raw = request.method + " " + request.target + " HTTP/1.1\r\n";
+  raw += "Host: " + host + "\r\n";
+  if (request.authorized) {
+    raw += "Authorization: Bearer " + token + "\r\n";
+  }
+  if (!body.empty()) {
+    raw += "Content-Type: application/json\r\n";
+  }
+  if (!body.empty() || request.method == "POST") {
+    raw += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  raw += "\r\n";
+  raw += body;
+  return raw;
+}
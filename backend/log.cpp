@@ -1,78 +1,291 @@
 #include "log.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
 #include <ctime>
-#include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-ReplicateToFileStreamBuffer::ReplicateToFileStreamBuffer(
-  std::shared_ptr<std::ofstream> fileStream,
-  std::ostream& stream,
-  const std::string& colorPrefix,
-  const std::string& streamName
-) : originalBuffer(stream.rdbuf()),
-    atLineStart(true),
+// each record is a 4 byte header (length, top bit set for cerr) and the line;
+// the owning thread is the only producer and the writer the only consumer
+constexpr size_t logRingSize = size_t(1) << 16;
+constexpr size_t maxLogLine = logRingSize / 4;
+constexpr uint32_t cerrRecordBit = uint32_t(1) << 31;
+constexpr auto logWriterInterval = std::chrono::milliseconds(10);
+constexpr size_t maxRecordsPerWrite = 256;
+
+struct LogRing {
+  std::array<char, logRingSize> data;
+  std::atomic<uint64_t> head{ 0 };
+  std::atomic<uint64_t> tail{ 0 };
+  std::atomic<bool> abandoned{ false };
+};
+
+// rings outlive their thread until the writer has drained them
+struct LogRingHandle {
+  std::shared_ptr<LogRing> ring;
+
+  ~LogRingHandle() {
+    if (ring) ring->abandoned = true;
+  }
+};
+
+std::mutex logRingsMtx;
+std::vector<std::shared_ptr<LogRing>> logRings;
+
+int logFileFd = -1;
+std::mutex logWriterMtx;
+std::condition_variable logWriterCv;
+std::atomic<bool> logWriterRunning(false);
+std::thread logWriterThread;
+
+std::unique_ptr<LogStreamBuffer> logCoutBuffer;
+std::unique_ptr<LogStreamBuffer> logCerrBuffer;
+
+thread_local std::string pendingLines[2];
+
+LogRing& localLogRing() {
+  thread_local LogRingHandle handle;
+  if (!handle.ring) {
+    handle.ring = std::make_shared<LogRing>();
+    std::lock_guard<std::mutex> lock(logRingsMtx);
+    logRings.push_back(handle.ring);
+  }
+  return *handle.ring;
+}
+
+// localtime and strftime run once per second per thread
+void appendTimestamp(std::string& line) {
+  thread_local std::time_t cachedSecond = -1;
+  thread_local char cached[48];
+  thread_local size_t cachedLength = 0;
+
+  std::time_t now = std::time(nullptr);
+  if (now != cachedSecond) {
+    std::tm local;
+    localtime_r(&now, &local);
+    cachedLength = std::strftime(cached, sizeof(cached), "[%d/%m/%Y : %H:%M:%S] ", &local);
+    cachedSecond = now;
+  }
+  line.append(cached, cachedLength);
+}
+
+void copyToRing(LogRing& ring, uint64_t position, const char* data, size_t size) {
+  size_t offset = position & (logRingSize - 1);
+  size_t first = std::min(size, logRingSize - offset);
+  std::memcpy(&ring.data[offset], data, first);
+  std::memcpy(&ring.data[0], data + first, size - first);
+}
+
+void pushLogRecord(int streamIndex, const std::string& line) {
+  LogRing& ring = localLogRing();
+  size_t size = std::min(line.size(), maxLogLine);
+  size_t needed = sizeof(uint32_t) + size;
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+  // a full ring waits for the writer rather than losing lines
+  while (head + needed - ring.tail.load(std::memory_order_acquire) > logRingSize) {
+    if (!logWriterRunning) return;
+    logWriterCv.notify_one();
+    std::this_thread::yield();
+  }
+
+  uint32_t header = static_cast<uint32_t>(size) | (streamIndex == 1 ? cerrRecordBit : 0);
+  copyToRing(ring, head, reinterpret_cast<const char*>(&header), sizeof(header));
+  copyToRing(ring, head + sizeof(header), line.data(), size);
+  ring.head.store(head + needed, std::memory_order_release);
+}
+
+LogStreamBuffer::LogStreamBuffer(std::ostream& stream, const std::string& colorPrefix, int streamIndex)
+  : stream(stream),
+    originalBuffer(stream.rdbuf()),
     prefix(colorPrefix),
-    streamName(streamName),
-    outputFile(fileStream) {
+    streamIndex(streamIndex) {
+  stream.flush();
   stream.rdbuf(this);
 }
 
-ReplicateToFileStreamBuffer::~ReplicateToFileStreamBuffer() {
-  if (originalBuffer) {
-    std::ostream& stream = streamName == "cout" ? std::cout : std::cerr;
-    stream.rdbuf(originalBuffer);
-  }
+LogStreamBuffer::~LogStreamBuffer() {
+  stream.rdbuf(originalBuffer);
 }
 
-int ReplicateToFileStreamBuffer::sync() {
-  if (originalBuffer->pubsync() == -1 || !outputFile->flush()) {
-    return -1;
+void LogStreamBuffer::append(const char* text, std::streamsize size) {
+  std::string& line = pendingLines[streamIndex];
+  const char* end = text + size;
+  while (text < end) {
+    const char* newline = static_cast<const char*>(std::memchr(text, '\n', end - text));
+    const char* stop = newline ? newline : end;
+    if (stop > text && line.empty()) {
+      appendTimestamp(line);
+      line += prefix;
+    }
+    line.append(text, stop);
+    if (!newline) break;
+    line += "\n\033[37m";
+    pushLogRecord(streamIndex, line);
+    line.clear();
+    text = newline + 1;
   }
-  return 0;
 }
 
-int ReplicateToFileStreamBuffer::overflow(int c) {
+std::streamsize LogStreamBuffer::xsputn(const char* text, std::streamsize size) {
+  append(text, size);
+  return size;
+}
+
+int LogStreamBuffer::overflow(int c) {
   if (c == EOF) {
     return EOF;
   }
+  char character = static_cast<char>(c);
+  append(&character, 1);
+  return c;
+}
+
+bool writeAllVectors(int fd, std::vector<iovec>& vectors) {
+  size_t index = 0;
+  while (index < vectors.size()) {
+    int count = static_cast<int>(std::min<size_t>(vectors.size() - index, IOV_MAX));
+    ssize_t written = writev(fd, &vectors[index], count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    while (written > 0 && index < vectors.size()) {
+      size_t size = vectors[index].iov_len;
+      if (static_cast<size_t>(written) >= size) {
+        written -= size;
+        index++;
+      } else {
+        vectors[index].iov_base = static_cast<char*>(vectors[index].iov_base) + written;
+        vectors[index].iov_len -= written;
+        written = 0;
+      }
+    }
+  }
+  return true;
+}
 
-  if (atLineStart && c != '\n') {
-    std::time_t now = std::time(nullptr);
-    std::string timeBuffer(30, '\0');
-    std::strftime(timeBuffer.data(), timeBuffer.size(), "%d/%m/%Y : %H:%M:%S", std::localtime(&now));
-    timeBuffer.resize(std::strlen(timeBuffer.data()));
-    std::string timestamp = "[" + timeBuffer + "] ";
+void appendRingVectors(LogRing& ring, uint64_t position, size_t size, std::vector<iovec>& vectors) {
+  size_t offset = position & (logRingSize - 1);
+  size_t first = std::min(size, logRingSize - offset);
+  vectors.push_back({ &ring.data[offset], first });
+  if (first < size) {
+    vectors.push_back({ &ring.data[0], size - first });
+  }
+}
 
-    originalBuffer->sputn(timestamp.c_str(), timestamp.size());
-    *outputFile << timestamp;
+// writes what the ring held when called, the lines are read in place and
+// the space is handed back once both destinations have them
+bool drainLogRing(LogRing& ring) {
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+  uint64_t head = ring.head.load(std::memory_order_acquire);
+  if (tail == head) return false;
 
-    originalBuffer->sputn(prefix.c_str(), prefix.size());
-    *outputFile << prefix;
+  std::vector<iovec> console[2];
+  std::vector<iovec> file;
+  size_t records = 0;
+  while (tail < head && records < maxRecordsPerWrite) {
+    uint32_t header;
+    char* bytes = reinterpret_cast<char*>(&header);
+    for (size_t i = 0; i < sizeof(header); i++) {
+      bytes[i] = ring.data[(tail + i) & (logRingSize - 1)];
+    }
+    size_t size = header & ~cerrRecordBit;
+    int streamIndex = header & cerrRecordBit ? 1 : 0;
+    appendRingVectors(ring, tail + sizeof(header), size, console[streamIndex]);
+    appendRingVectors(ring, tail + sizeof(header), size, file);
+    tail += sizeof(header) + size;
+    records++;
   }
 
-  if (originalBuffer->sputc(c) == EOF || !(*outputFile << static_cast<char>(c))) {
-    return EOF;
+  writeAllVectors(STDOUT_FILENO, console[0]);
+  writeAllVectors(STDERR_FILENO, console[1]);
+  if (logFileFd != -1) {
+    writeAllVectors(logFileFd, file);
+  }
+  ring.tail.store(tail, std::memory_order_release);
+  return true;
+}
+
+// one pass over every ring, rings of finished threads are dropped once empty
+bool drainLogRings() {
+  std::vector<std::shared_ptr<LogRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(logRingsMtx);
+    rings = logRings;
+  }
+
+  bool wrote = false;
+  for (const auto& ring : rings) {
+    wrote = drainLogRing(*ring) || wrote;
   }
 
-  if (c == '\n') {
-    originalBuffer->sputn("\033[37m", 5);
-    *outputFile << "\033[37m";
+  std::lock_guard<std::mutex> lock(logRingsMtx);
+  logRings.erase(std::remove_if(logRings.begin(), logRings.end(), [](const std::shared_ptr<LogRing>& ring) {
+    return ring->abandoned && ring->tail.load() == ring->head.load();
+  }), logRings.end());
+  return wrote;
+}
 
-    outputFile->flush();
-    originalBuffer->pubsync();
+void logWriterLoop() {
+  while (true) {
+    bool running;
+    {
+      std::unique_lock<std::mutex> lock(logWriterMtx);
+      logWriterCv.wait_for(lock, logWriterInterval, [] { return !logWriterRunning; });
+      running = logWriterRunning;
+    }
+    while (drainLogRings()) {}
+    if (!running) break;
   }
+}
 
-  atLineStart = (c == '\n');
-  return c;
+bool startLogWriter(const std::string& path) {
+  logFileFd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (logFileFd == -1) {
+    return false;
+  }
+  logWriterRunning = true;
+  logWriterThread = std::thread(logWriterLoop);
+  return true;
+}
+
+void stopLogWriter() {
+  logCoutBuffer.reset();
+  logCerrBuffer.reset();
+  {
+    std::lock_guard<std::mutex> lock(logWriterMtx);
+    logWriterRunning = false;
+  }
+  logWriterCv.notify_all();
+  if (logWriterThread.joinable()) {
+    logWriterThread.join();
+  }
+  if (logFileFd != -1) {
+    close(logFileFd);
+    logFileFd = -1;
+  }
 }
 
-void initLogCout(std::shared_ptr<std::ofstream> file) {
-  static ReplicateToFileStreamBuffer logCoutBuffer(file, std::cout, "\033[32m", "cout");
+void initLogCout() {
+  logCoutBuffer = std::make_unique<LogStreamBuffer>(std::cout, "\033[32m", 0);
 }
 
-void initLogCerr(std::shared_ptr<std::ofstream> file) {
-  static ReplicateToFileStreamBuffer logCerrBuffer(file, std::cerr, "\033[31m", "cerr");
+void initLogCerr() {
+  logCerrBuffer = std::make_unique<LogStreamBuffer>(std::cerr, "\033[31m", 1);
 }
@@ -1,29 +1,36 @@
 #ifndef LOG_H
 #define LOG_H
 
-#include <string>
-#include <memory>
+#include <ostream>
 #include <streambuf>
-#include <fstream>
+#include <string>
 
-class ReplicateToFileStreamBuffer : public std::streambuf {
+// cout and cerr lines are stamped and colored on the calling thread, handed
+// to a per-thread ring and written to the console and the log file by a
+// background writer
+class LogStreamBuffer : public std::streambuf {
 private:
+  std::ostream& stream;
   std::streambuf* originalBuffer;
-  std::shared_ptr<std::ofstream> outputFile;
   std::string prefix;
-  std::string streamName;
-  bool atLineStart;
+  int streamIndex;
+
+  void append(const char*, std::streamsize);
 
 protected:
-  int sync() override;
+  std::streamsize xsputn(const char*, std::streamsize) override;
   int overflow(int) override;
 
 public:
-  ReplicateToFileStreamBuffer(std::shared_ptr<std::ofstream>, std::ostream&, const std::string&, const std::string&);
-  ~ReplicateToFileStreamBuffer();
+  LogStreamBuffer(std::ostream&, const std::string&, int);
+  ~LogStreamBuffer();
 };
 
-void initLogCout(std::shared_ptr<std::ofstream>);
-void initLogCerr(std::shared_ptr<std::ofstream>);
+bool startLogWriter(const std::string&);
+// restores cout and cerr, then writes out everything still queued
+void stopLogWriter();
+
+void initLogCout();
+void initLogCerr();
 
 #endif // LOG_H
@@ -1,36 +1,54 @@
 #include "http.h"
 #include "server.h"
 #include "types.h"
-#include "db.h"
+#include "storage.h"
 #include "security.h"
 #include "log.h"
-
+#include "daily.h"
+#include "day.h"
+#include "catalog.h"
+#include "search.h"
+#include "fuzzy.h"
+#include "guess.h"
+#include "scores.h"
+#include "leaderboard.h"
+#include "ingest.h"
+#include "apicache.h"
+#include "sessions.h"
+#include "passwords.h"
+#include "revoke.h"
+#include "ratelimit.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <charconv>
 #include <chrono>
 #include <ctime>
+#include <functional>
 #include <iomanip>
 #include <ios>
 #include <iostream>
-#include <fstream>
+#include <algorithm>
 #include <memory>
 #include <ostream>
-#include <regex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <cstdlib>
-#include <bsoncxx/json.hpp>
-#include <bsoncxx/builder/stream/document.hpp>
-#include <bsoncxx/builder/stream/helpers.hpp>
-#include <bsoncxx/builder/basic/document.hpp>
-#include <bsoncxx/builder/basic/kvp.hpp>
-#include <mongocxx/client.hpp>
 #include <mongocxx/instance.hpp>
-#include <mongocxx/database.hpp>
-#include <mongocxx/options/find.hpp>
 
 ServerOptions options;
 bool logToFile = false;
+int pregenerateDays = 2;
+std::string cacheDir = "cache";
+bool offline = false;
+unsigned traceEvery = 1000;
+unsigned traceSlowMs = 250;
+std::string traceFile;
 std::string apiToken;
+std::string storageBackend = "mongo";
+std::string seedFile = "fixtures/seed.jsonl";
+bool rateLimit = true;
 
 void processCliArgs(int argc, char** argv) {
   for (int i = 1; i < argc; i++) {
@@ -39,6 +57,26 @@ void processCliArgs(int argc, char** argv) {
       options.debug = true;
     } else if (arg == "-l" || arg == "--log") {
       logToFile = true;
+    } else if ((arg == "-p" || arg == "--pregenerate") && i + 1 < argc) {
+      pregenerateDays = std::stoi(argv[++i]);
+    } else if ((arg == "-c" || arg == "--cache-dir") && i + 1 < argc) {
+      cacheDir = argv[++i];
+    } else if (arg == "--no-cache") {
+      cacheDir.clear();
+    } else if (arg == "--offline") {
+      offline = true;
+    } else if (arg == "--trace-sample" && i + 1 < argc) {
+      traceEvery = std::stoul(argv[++i]);
+    } else if (arg == "--trace-slow-ms" && i + 1 < argc) {
+      traceSlowMs = std::stoul(argv[++i]);
+    } else if (arg == "--trace-file" && i + 1 < argc) {
+      traceFile = argv[++i];
+    } else if (arg == "--storage" && i + 1 < argc) {
+      storageBackend = argv[++i];
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seedFile = argv[++i];
+    } else if (arg == "--no-rate-limit") {
+      rateLimit = false;
     }
   }
 }
@@ -52,19 +90,30 @@ bool validateRequestLogin(const HttpObject& request) {
       body.object.at("password").type != Json::Type::VALUE) return false;
   return true;
 }
-bool validateLogin(const HttpObject& request, const mongocxx::database& db) {
+// answers OK, UNAUTHORIZED, INTERNAL_SERVER_ERROR, or SERVICE_UNAVAILABLE when
+// the password hashers are saturated; called on a hasher thread once scrypt ran
+void validateLogin(const HttpObject& request, Storage& storage, std::function<void(ResponseStatus)> done) {
   const auto& body = request.body;
   std::string username = body.object.at("username").value;
   username.erase(0, 1);
   username.erase(username.length() - 1);
-  const std::string& password = hashPassword(body.object.at("password").value);
-  auto users = db["users"];
-  auto filter = bsoncxx::builder::stream::document{}
-    << "username" << username
-    << "password" << password
-    << bsoncxx::builder::stream::finalize;
-  auto result = users.find_one(filter.view());
-  return result ? true : false;
+  auto stored = storage.findPassword(username);
+  if (!stored) return done(UNAUTHORIZED);
+
+  bool queued = checkPasswordAsync(body.object.at("password").value, *stored, [username, &storage, done](const PasswordCheck& check) {
+    if (check.failed) return done(INTERNAL_SERVER_ERROR);
+    if (!check.matches) return done(UNAUTHORIZED);
+    if (!check.rehashed.empty()) {
+      try {
+        storage.updatePassword(username, check.rehashed);
+      } catch (const std::exception& e) {
+        // the old hash still verifies, the upgrade is retried on the next login
+        std::cerr << "[main.cpp:validateLogin] " << e.what() << "\n";
+      }
+    }
+    done(OK);
+  });
+  if (!queued) done(SERVICE_UNAVAILABLE);
 }
 bool validateRequestRegister(const HttpObject& request) {
   const auto& body = request.body;
@@ -75,30 +124,53 @@ bool validateRequestRegister(const HttpObject& request) {
       body.object.at("password").type != Json::Type::VALUE) return false;
   return true;
 }
-bool validateRegister(const HttpObject& request, const mongocxx::database& db) {
+bool validateRegister(const HttpObject& request, Storage& storage) {
   const auto& body = request.body;
   std::string username = body.object.at("username").value;
   username.erase(0, 1);
   username.erase(username.length() - 1);
-  auto users = db["users"];
-  auto filter = bsoncxx::builder::stream::document{}
-    << "username" << username
-    << bsoncxx::builder::stream::finalize;
-  auto result = users.find_one(filter.view());
-  return result ? false : true;
+  return !storage.findPassword(username);
 }
-void doRegister(const HttpObject& request, const mongocxx::database& db) {
+// answers OK, CONFLICT when the username was taken while hashing,
+// INTERNAL_SERVER_ERROR, or SERVICE_UNAVAILABLE when the password hashers are saturated
+void doRegister(const HttpObject& request, Storage& storage, std::function<void(ResponseStatus)> done) {
   const auto& body = request.body;
   std::string username = body.object.at("username").value;
   username.erase(0, 1);
   username.erase(username.length() - 1);
-  const std::string& password = hashPassword(body.object.at("password").value);
-  auto users = db["users"];
-  bsoncxx::builder::stream::document doc_builder;
-  doc_builder
-    << "username" << username
-    << "password" << password;
-  users.insert_one(doc_builder.view());
+  bool queued = hashPasswordAsync(body.object.at("password").value, [username, &storage, done](const std::string& password) {
+    if (password.empty()) return done(INTERNAL_SERVER_ERROR);
+    try {
+      done(storage.insertUser(username, password) ? OK : CONFLICT);
+    } catch (const std::exception& e) {
+      std::cerr << "[main.cpp:doRegister] " << e.what() << "\n";
+      done(INTERNAL_SERVER_ERROR);
+    }
+  });
+  if (!queued) done(SERVICE_UNAVAILABLE);
+}
+// token for a successful login or registration, otherwise the error of the status
+std::string createCredentialsResponse(ResponseStatus status, const std::string& ip, const std::string& username, const std::string& busy) {
+  Json body;
+  body.type = Json::Type::VALUE;
+  switch (status) {
+    case OK:
+      body.value = createJwt(ip, username, 60 * 30);
+      break;
+    case UNAUTHORIZED:
+      body.value = "username and password do not match";
+      break;
+    case CONFLICT:
+      body.value = "username already registered";
+      break;
+    case SERVICE_UNAVAILABLE:
+      body.value = busy;
+      break;
+    default:
+      status = INTERNAL_SERVER_ERROR;
+      body.value = "internal server error";
+  }
+  return createResponse(status, body);
 }
 bool validateRequestValidate(const HttpObject& request) {
   return request.headers.find("Authorization") != request.headers.end();
@@ -110,173 +182,172 @@ bool validateRequestRefresh(const HttpObject& request) {
       request.body.object.at("username").type != Json::Type::VALUE) return false;
   return true;
 }
-bool checkSameOwnerOfJwt(const HttpObject& request, const std::string& token) {
+bool checkSameOwnerOfJwt(const HttpObject& request, const JwtClaims& claims) {
   std::string requestHost = request.headers.at("Host");
   std::string requestUsername = request.body.object.at("username").value;
   requestUsername.erase(0, 1);
   requestUsername.erase(requestUsername.length() - 1);
 
-  auto [tokenHost, tokenUsername] = extractHostAndUsername(token);
-  return requestHost == tokenHost && requestUsername == tokenUsername;
+  return requestHost == claims.ip && requestUsername == claims.username;
+}
+constexpr Day firstDay = dayFromCivil(2025, 1, 1);
+constexpr int dailiesPageSize = 31;
+constexpr int maxDailiesRange = 366;
+
+bool isValidDate(const std::string& date, Day& day) {
+  return parseDay(date, day) && day >= firstDay;
 }
-std::string getCurrentDate() {
-  auto now = std::chrono::system_clock::now();
-  std::time_t nowTime = std::chrono::system_clock::to_time_t(now);
-  std::tm* nowTm = std::localtime(&nowTime);
-
-  std::ostringstream oss;
-  oss << std::put_time(nowTm, "%d/%m/%Y");
-  return oss.str();
+bool isTodayOrFuture(Day day) {
+  return day >= getCurrentDay();
 }
-bool isValidDate(const std::string& date) {
-  std::regex dateRegex(R"(^\d{2}/\d{2}/\d{4}$)");
-  if (!std::regex_match(date, dateRegex)) {
-    return false;
+bool validateRequestSearch(const HttpObject& request, size_t& limit) {
+  const auto& params = request.queryParams;
+  if (params.find("q") == params.end() || params.at("q").empty() || params.at("q").size() > 100) return false;
+
+  limit = searchTopK;
+  if (params.find("limit") != params.end()) {
+    const std::string& limitStr = params.at("limit");
+    if (limitStr.empty() || limitStr.size() > 2 ||
+        limitStr.find_first_not_of("0123456789") != std::string::npos) return false;
+    limit = std::stoul(limitStr);
   }
+  return limit >= 1 && limit <= searchTopK;
+}
+bool validateRequestCheck(const HttpObject& request) {
+  const auto& params = request.queryParams;
+  return params.find("guess") != params.end() && !params.at("guess").empty() && params.at("guess").size() <= 200;
+}
+bool validateRequestEvaluate(const HttpObject& request) {
+  const auto& params = request.queryParams;
+  return params.find("anime") != params.end() && params.at("anime").size() == 24;
+}
+constexpr int maxAttempts = 10;
 
-  int day, month, year;
-  sscanf(date.c_str(), "%d/%d/%d", &day, &month, &year);
-
-  if (year < 2025 || month < 1 || month > 12 || day < 1 || day > 31) {
-    return false;
+bool validateRequestScore(const HttpObject& request, Score& score) {
+  if (request.headers.find("Authorization") == request.headers.end()) return false;
+  const auto& body = request.body;
+  if (body.type != Json::Type::OBJECT) return false;
+  for (const char* field : { "day", "game", "attempts", "solved" }) {
+    if (body.object.find(field) == body.object.end() ||
+        body.object.at(field).type != Json::Type::VALUE) return false;
   }
 
-  static const int daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
-  if (month == 2 && year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)) {
-    if (day > 29) return false;
-  } else if (day > daysInMonth[month - 1]) {
-    return false;
+  std::string day = body.object.at("day").value;
+  std::string game = body.object.at("game").value;
+  if (day.size() < 2 || game.size() < 2) return false;
+  day = day.substr(1, day.length() - 2);
+  game = game.substr(1, game.length() - 2);
+  if (!isValidDate(day, score.day) || score.day != getCurrentDay()) return false;
+  if (game != "anime" && game != "character" && game != "screenshot") return false;
+  score.game = game;
+
+  const std::string& attempts = body.object.at("attempts").value;
+  if (attempts.empty() || attempts.size() > 2 ||
+      attempts.find_first_not_of("0123456789") != std::string::npos) return false;
+  score.attempts = std::stoi(attempts);
+  if (score.attempts < 1 || score.attempts > maxAttempts) return false;
+
+  const std::string& solved = body.object.at("solved").value;
+  if (solved != "true" && solved != "false") return false;
+  score.solved = solved == "true";
+  return true;
+}
+bool validateRequestGuess(const HttpObject& request, std::string& game, std::string& guess) {
+  if (request.headers.find("Authorization") == request.headers.end()) return false;
+  const auto& body = request.body;
+  if (body.type != Json::Type::OBJECT) return false;
+  for (const char* field : { "game", "guess" }) {
+    if (body.object.find(field) == body.object.end() ||
+        body.object.at(field).type != Json::Type::VALUE) return false;
   }
 
-  return true;
+  game = body.object.at("game").value;
+  guess = body.object.at("guess").value;
+  if (game.size() < 2 || guess.size() < 3 || guess.size() > 66) return false;
+  game = game.substr(1, game.length() - 2);
+  guess = guess.substr(1, guess.length() - 2);
+  return game == "anime" || game == "character" || game == "screenshot";
 }
-int getRandom(int interval_max) {
-  srand(time(nullptr));
-  int random = rand();
-  return (int)(((double) random) / RAND_MAX * (interval_max));
+// attempts and solved come from the client, the finished game of the session
+// has the final say
+bool matchesSession(const Score& score) {
+  GameSession session;
+  if (!getSession(score.username, score.day, session)) return false;
+  auto played = session.games.find(score.game);
+  if (played == session.games.end()) return false;
+  const GameProgress& progress = played->second;
+  if (!progress.solved && progress.guesses.size() < maxAttempts) return false;
+  return score.attempts == static_cast<int>(progress.guesses.size()) && score.solved == progress.solved;
 }
-bool isTodayOrFuture(const std::string& date) {
-  std::string currentDate = getCurrentDate();
-
-  auto convertToComparable = [](const std::string& dateStr) {
-    std::istringstream iss(dateStr);
-    int day, month, year;
-    sscanf(dateStr.c_str(), "%d/%d/%d", &day, &month, &year);
-    return year * 10000 + month * 100 + day;
-  };
-
-  return convertToComparable(date) >= convertToComparable(currentDate);
+int computePoints(const Score& score) {
+  if (!score.solved) return 0;
+  return (maxAttempts + 1 - score.attempts) * 100 / maxAttempts;
 }
-Json getOrCreateDaily(const std::string& day, const mongocxx::database& db) {
-  Json response;
-  auto dailies = db["dailies"];
-  auto animeDb = db["anime"];
-
-  bsoncxx::builder::stream::document filterBuilderDaily;
-  filterBuilderDaily << "day" << day;
-  auto document = dailies.find_one(filterBuilderDaily.view());
-  
-  if (!document) {
-    auto count = animeDb.count_documents({});
-    int skip = 0;
-    int difficulty = getRandom(9) + 1;
-    std::string diff;
-    if (difficulty <= 5) {
-      skip = getRandom(499);
-      diff = "easy";
-    } else if (difficulty <= 8) {
-      skip = getRandom(2999);
-      diff = "medium";
-    } else {
-      skip = getRandom(5999);
-      diff = "hard";
-    }
-
-    mongocxx::options::find optionsDaily{};
-    optionsDaily.skip(skip).limit(1).projection(
-      bsoncxx::builder::basic::make_document(
-        bsoncxx::builder::basic::kvp(
-          "_id", 1
-        ), bsoncxx::builder::basic::kvp(
-          "title", 1
-        )
-      )
-    );
-    auto animes = animeDb.find({}, optionsDaily);
-    // TODO if not updated in one week update the entry
-
-    int i = 0;
-    for (auto&& anime : animes) {
-      i++;
-      if (i != 1) {
-        std::cerr << "[main.cpp:getOrCreateDaily] found none/more than 1 (" << i
-          << "), skip: " << skip
-          << ", day: " << day
-          << ", count: " << count
-          << "\n";
-        throw std::runtime_error("getOrCreateDaily");
-      }
-
-      auto id = anime["_id"].get_oid();
-      std::cout << "Created entry for " << day
-        << " with anime: \"" << anime["title"].get_string().value.data()
-        << "\" and difficulty: " << diff
-        << "\n";
-      Json daily;
-      daily.type = Json::Type::OBJECT;
-      daily.object["anime"].type = Json::Type::OID;
-      daily.object["anime"].oid = id;
-      daily.object["day"].type = Json::Type::VALUE;
-      daily.object["day"].value = day;
-      daily.object["difficulty"].type = Json::Type::VALUE;
-      daily.object["difficulty"].value = diff;
-      auto doc = createDocument(daily);
-      std::cout << bsoncxx::to_json(doc) << "\n";
-      dailies.insert_one(doc.view());
-      document = dailies.find_one(filterBuilderDaily.view());
-    }
+constexpr size_t maxLeaderboardLimit = 100;
+
+bool validateRequestLeaderboard(const HttpObject& request, Day& day, size_t& limit) {
+  const auto& params = request.queryParams;
+  day = getCurrentDay();
+  if (params.find("day") != params.end() &&
+      (!isValidDate(params.at("day"), day) || day > getCurrentDay())) return false;
+
+  limit = 10;
+  if (params.find("limit") != params.end()) {
+    const std::string& limitStr = params.at("limit");
+    if (limitStr.empty() || limitStr.size() > 3 ||
+        limitStr.find_first_not_of("0123456789") != std::string::npos) return false;
+    limit = std::stoul(limitStr);
   }
-
-  response = parseDocument(document);
-
-  bsoncxx::builder::stream::document filterBuilderAnime;
-  filterBuilderAnime << "_id" << response.object["anime"].oid;
-  document = animeDb.find_one(filterBuilderAnime.view());
-
-  response.object["anime"] = parseDocument(document);
-
-  return response;
+  return limit >= 1 && limit <= maxLeaderboardLimit;
+}
+bool validateRequestDailies(const HttpObject& request, Day& from, Day& to, int& page) {
+  const auto& params = request.queryParams;
+  if (params.find("from") == params.end() || params.find("to") == params.end()) return false;
+  if (!isValidDate(params.at("from"), from) || !isValidDate(params.at("to"), to)) return false;
+  to = std::min(to, getCurrentDay() - 1);
+  if (from > to || to - from >= maxDailiesRange) return false;
+
+  page = 0;
+  if (params.find("page") != params.end()) {
+    const std::string& pageStr = params.at("page");
+    if (pageStr.empty() || pageStr.size() > 2 ||
+        pageStr.find_first_not_of("0123456789") != std::string::npos) return false;
+    page = std::stoi(pageStr);
+  }
+  return page <= (to - from) / dailiesPageSize;
 }
 
 int main(int argc, char** argv) {
   options.port = 8080;
   processCliArgs(argc, argv);
+  configureResponseCache(cacheDir, offline);
+  setRateLimiting(rateLimit);
 
-  apiToken = std::getenv("TOKEN");
+  const char* token = std::getenv("TOKEN");
+  apiToken = token ? token : "";
   if (options.debug) {
     std::cout << "Token: " << apiToken << "\n";
   }
 
   mongocxx::instance instance;
-  mongocxx::client client = createDBClient(std::getenv("MONGO_URI"));
-  mongocxx::database db = client[std::getenv("MONGO_DB")];
-  createCollection(db, "users");
-  createCollection(db, "dailies");
-  createCollection(db, "scores");
-  createCollection(db, "jwt");
+  std::unique_ptr<Storage> storage;
+  if (storageBackend == "memory") {
+    storage = createMemoryStorage(seedFile);
+  } else {
+    const char* uri = std::getenv("MONGO_URI");
+    const char* dbName = std::getenv("MONGO_DB");
+    if (!uri || !dbName) {
+      std::cerr << "MONGO_URI and MONGO_DB must be set, or use --storage memory\n";
+      return 1;
+    }
+    storage = createMongoStorage(uri, dbName);
+  }
+  loadCatalog(*storage);
 
   std::string jwtKey;
 
   try {
-    if (db["jwt"].count_documents({}) == 0) {
-      bsoncxx::builder::stream::document doc_builder;
-      doc_builder << "key" << createJwtKey(32);
-      db["jwt"].insert_one(doc_builder.view());
-    }
-    auto token = db["jwt"].find_one({});
-    if (token) {
-      jwtKey = token->view()["key"].get_string().value.data();
-    }
+    jwtKey = storage->loadJwtKey();
   } catch (const std::exception& e) {
     std::cerr << "Error: " << e.what() << "\n";
   }
@@ -287,12 +358,13 @@ int main(int argc, char** argv) {
   base.path = "";
   base.method = Method::GET;
   base.handler = [](const HttpObject& request) {
+    const char* discord = std::getenv("DISCORD");
     Json body;
     body.type = Json::Type::OBJECT;
     body.object["status"].type = Json::Type::VALUE;
     body.object["status"].value = "running";
     body.object["details"].type = Json::Type::VALUE;
-    body.object["details"].value = "for more info contact me on discord: " + std::string(std::getenv("DISCORD"));
+    body.object["details"].value = "for more info contact me on discord: " + std::string(discord ? discord : "");
     return createResponse(OK, body);
   };
 
@@ -301,61 +373,44 @@ int main(int argc, char** argv) {
   Route login;
   login.path = "login";
   login.method = Method::POST;
-  login.handler = [&](const HttpObject& request) {
+  // scrypt runs on the password hashers, which answer the client themselves
+  login.deferredHandler = [&](const HttpObject& request, Responder respond) {
     if (!validateRequestLogin(request)) {
       Json invalid;
       invalid.type = Json::Type::VALUE;
       invalid.value = "request not valid";
-      return createResponse(BAD_REQUEST, invalid);
+      return respond(createResponse(BAD_REQUEST, invalid));
     }
-    if (!validateLogin(request, db)) {
-      Json invalid;
-      invalid.type = Json::Type::VALUE;
-      invalid.value = "username and password do not match";
-      return createResponse(UNAUTHORIZED, invalid);
-    }
-    Json token;
-    token.type = Json::Type::VALUE;
+    std::string ip = request.ip;
     std::string username = request.body.object.at("username").value;
     username.erase(0, 1);
     username.erase(username.length() - 1);
-    token.value = createJwt(
-      request.ip,
-      username,
-      60 * 30
-    );
-    return createResponse(OK, token);
+    validateLogin(request, *storage, [respond, ip, username](ResponseStatus status) {
+      respond(createCredentialsResponse(status, ip, username, "too many logins, try again"));
+    });
   };
   base.nested = &login;
 
   Route registerUser;
   registerUser.path = "register";
   registerUser.method = Method::POST;
-  registerUser.handler = [&](const HttpObject& request) {
+  registerUser.deferredHandler = [&](const HttpObject& request, Responder respond) {
     if (!validateRequestRegister(request)) {
       Json invalid;
       invalid.type = Json::Type::VALUE;
       invalid.value = "request not valid";
-      return createResponse(BAD_REQUEST, invalid);
+      return respond(createResponse(BAD_REQUEST, invalid));
     }
-    if (!validateRegister(request, db)) {
-      Json invalid;
-      invalid.type = Json::Type::VALUE;
-      invalid.value = "username already registered";
-      return createResponse(CONFLICT, invalid);
+    if (!validateRegister(request, *storage)) {
+      return respond(createCredentialsResponse(CONFLICT, "", "", ""));
     }
-    doRegister(request, db);
-    Json token;
-    token.type = Json::Type::VALUE;
+    std::string ip = request.ip;
     std::string username = request.body.object.at("username").value;
     username.erase(0, 1);
     username.erase(username.length() - 1);
-    token.value = createJwt(
-      request.ip,
-      username,
-      60 * 30
-    );
-    return createResponse(OK, token);
+    doRegister(request, *storage, [respond, ip, username](ResponseStatus status) {
+      respond(createCredentialsResponse(status, ip, username, "too many registrations, try again"));
+    });
   };
   login.next = &registerUser;
 
@@ -396,7 +451,8 @@ int main(int argc, char** argv) {
     }
     std::string bearer = request.headers.at("Authorization");
     std::string token = bearer.substr(7);
-    if (isJwtValid(token) && checkSameOwnerOfJwt(request, token)) {
+    JwtClaims claims;
+    if (verifyJwt(token, claims) && checkSameOwnerOfJwt(request, claims)) {
       Json token;
       token.type = Json::Type::VALUE;
       std::string username = request.body.object.at("username").value;
@@ -420,44 +476,476 @@ int main(int argc, char** argv) {
   daily.path = "daily";
   daily.method = Method::GET;
   daily.handler = [&](const HttpObject& request) {
-    std::string day = getCurrentDate();
+    Day day = getCurrentDay();
     if (request.queryParams.find("day") != request.queryParams.end()) {
-      day = request.queryParams.at("day");
-      if (!isValidDate(day) || isTodayOrFuture(day)) {
+      if (!isValidDate(request.queryParams.at("day"), day) || isTodayOrFuture(day)) {
         Json invalid;
         invalid.type = Json::Type::VALUE;
         invalid.value = "request not valid";
         return createResponse(BAD_REQUEST, invalid);
       }
     }
-    Json response = getOrCreateDaily(day, db);
-    return createResponse(OK, response);
+    return getDailyResponse(day, *storage);
+  };
+  daily.cacheMetadata = [](const HttpObject& request) {
+    Day day = getCurrentDay();
+    auto dayParam = request.queryParams.find("day");
+    if (dayParam != request.queryParams.end() &&
+        (!isValidDate(dayParam->second, day) || isTodayOrFuture(day))) {
+      return CacheMetadata{};
+    }
+    return getDailyCacheMetadata(day);
   };
   refresh.next = &daily;
 
+  Route dailies;
+  dailies.path = "dailies";
+  dailies.method = Method::GET;
+  dailies.handler = [&](const HttpObject& request) {
+    Day from, to;
+    int page;
+    if (!validateRequestDailies(request, from, to, page)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    Day pageFrom = from + page * dailiesPageSize;
+    Day pageTo = std::min(to, pageFrom + (dailiesPageSize - 1));
+    std::string body = "{\"page\":" + std::to_string(page)
+      + ",\"pages\":" + std::to_string((to - from) / dailiesPageSize + 1)
+      + ",\"dailies\":" + getDailiesJson(pageFrom, pageTo, *storage)
+      + "}";
+    CacheMetadata metadata;
+    metadata.etag = computeETag(body);
+    metadata.cacheControl = "public, max-age=3600";
+    auto ifNoneMatch = request.headers.find("If-None-Match");
+    if (ifNoneMatch != request.headers.end() && matchesETag(ifNoneMatch->second, metadata.etag)) {
+      return createNotModifiedResponse(metadata);
+    }
+    return createResponse(OK, "application/json", body, metadata);
+  };
+  daily.next = &dailies;
+
+  Route search;
+  search.path = "search";
+  search.method = Method::GET;
+  search.handler = [](const HttpObject& request) {
+    size_t limit;
+    if (!validateRequestSearch(request, limit)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    Json results;
+    results.type = Json::Type::ARRAY;
+    for (uint32_t index : searchTitles(request.queryParams.at("q"), limit)) {
+      auto entry = getCatalogEntry(index);
+      if (!entry) continue;
+      Json result;
+      result.type = Json::Type::OBJECT;
+      result.object["id"].type = Json::Type::VALUE;
+      result.object["id"].value = entry->id;
+      result.object["title"].type = Json::Type::VALUE;
+      result.object["title"].value = entry->title;
+      result.object["english"].type = Json::Type::VALUE;
+      result.object["english"].value = entry->english;
+      results.array.push_back(result);
+    }
+    return createResponse(OK, results);
+  };
+  dailies.next = &search;
+
+  Route check;
+  check.path = "check";
+  check.method = Method::GET;
+  check.handler = [&](const HttpObject& request) {
+    if (!validateRequestCheck(request)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    const std::string& guess = request.queryParams.at("guess");
+    int64_t answer = findCatalogIndex(getDailyAnimeId(getCurrentDay(), *storage));
+    auto matches = fuzzyMatch(guess, fuzzyMaxDistance(guess), 8);
+
+    // the guess names the answer if the answer is among the closest titles
+    Json result;
+    result.type = Json::Type::OBJECT;
+    result.object["correct"].type = Json::Type::VALUE;
+    result.object["correct"].value = "false";
+    for (const auto& match : matches) {
+      if (match.distance > matches.front().distance) break;
+      if (match.entry == answer) {
+        result.object["correct"].value = "true";
+        result.object["distance"].type = Json::Type::VALUE;
+        result.object["distance"].value = std::to_string(match.distance);
+        break;
+      }
+    }
+    if (!matches.empty()) {
+      auto entry = getCatalogEntry(matches.front().entry);
+      result.object["match"].type = Json::Type::VALUE;
+      result.object["match"].value = entry ? entry->title : "";
+    }
+    return createResponse(OK, result);
+  };
+  search.next = &check;
+
+  Route evaluate;
+  evaluate.path = "evaluate";
+  evaluate.method = Method::GET;
+  evaluate.handler = [&](const HttpObject& request) {
+    std::shared_ptr<const CatalogEntry> guess;
+    if (validateRequestEvaluate(request)) {
+      int64_t index = findCatalogIndex(request.queryParams.at("anime"));
+      guess = index >= 0 ? getCatalogEntry(index) : nullptr;
+    }
+    if (!guess) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    int64_t answerIndex = findCatalogIndex(getDailyAnimeId(getCurrentDay(), *storage));
+    auto answer = answerIndex >= 0 ? getCatalogEntry(answerIndex) : nullptr;
+    if (!answer) {
+      Json error;
+      error.type = Json::Type::VALUE;
+      error.value = "daily anime not in catalog";
+      return createResponse(INTERNAL_SERVER_ERROR, error);
+    }
+    return createResponse(OK, evaluateGuess(*guess, *answer));
+  };
+  check.next = &evaluate;
+
+  Route score;
+  score.path = "score";
+  score.method = Method::POST;
+  score.handler = [](const HttpObject& request) {
+    Score submitted;
+    if (!validateRequestScore(request, submitted)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    std::string token = request.headers.at("Authorization").substr(7);
+    JwtClaims claims;
+    if (!verifyJwt(token, claims)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt invalid";
+      return createResponse(FORBIDDEN, invalid);
+    }
+    submitted.username = claims.username;
+    if (!matchesSession(submitted)) {
+      Json mismatch;
+      mismatch.type = Json::Type::VALUE;
+      mismatch.value = "score does not match the game played";
+      return createResponse(CONFLICT, mismatch);
+    }
+    submitted.key = submitted.username + ":" + std::to_string(submitted.day.value) + ":" + submitted.game;
+    submitted.points = computePoints(submitted);
+    submitted.submittedAt = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+
+    Json result;
+    result.type = Json::Type::VALUE;
+    switch (submitScore(submitted)) {
+      case ScoreSubmission::ACCEPTED:
+        result.value = "score accepted";
+        return createResponse(ACCEPTED, result);
+      case ScoreSubmission::DUPLICATE:
+        result.value = "score already submitted";
+        return createResponse(ACCEPTED, result);
+      default:
+        result.value = "try again later";
+        return createResponse(SERVICE_UNAVAILABLE, result);
+    }
+  };
+  evaluate.next = &score;
+
+  Route leaderboard;
+  leaderboard.path = "leaderboard";
+  leaderboard.method = Method::GET;
+  leaderboard.handler = [](const HttpObject& request) {
+    Day day;
+    size_t limit;
+    if (!validateRequestLeaderboard(request, day, limit)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    Json results;
+    results.type = Json::Type::ARRAY;
+    for (const auto& entry : getLeaderboardTop(day, limit)) {
+      Json result;
+      result.type = Json::Type::OBJECT;
+      result.object["rank"].type = Json::Type::VALUE;
+      result.object["rank"].value = std::to_string(entry.rank);
+      result.object["username"].type = Json::Type::VALUE;
+      result.object["username"].value = entry.username;
+      result.object["points"].type = Json::Type::VALUE;
+      result.object["points"].value = std::to_string(entry.points);
+      results.array.push_back(result);
+    }
+    return createResponse(OK, results);
+  };
+  score.next = &leaderboard;
+
+  Route rank;
+  rank.path = "rank";
+  rank.method = Method::GET;
+  rank.handler = [](const HttpObject& request) {
+    Day day;
+    size_t limit;
+    if (!validateRequestValidate(request) || !validateRequestLeaderboard(request, day, limit)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    std::string token = request.headers.at("Authorization").substr(7);
+    JwtClaims claims;
+    if (!verifyJwt(token, claims)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt invalid";
+      return createResponse(FORBIDDEN, invalid);
+    }
+    LeaderboardEntry entry;
+    if (!getLeaderboardRank(day, claims.username, entry)) {
+      Json missing;
+      missing.type = Json::Type::VALUE;
+      missing.value = "no score for this day";
+      return createResponse(NOT_FOUND, missing);
+    }
+    Json result;
+    result.type = Json::Type::OBJECT;
+    result.object["rank"].type = Json::Type::VALUE;
+    result.object["rank"].value = std::to_string(entry.rank);
+    result.object["points"].type = Json::Type::VALUE;
+    result.object["points"].value = std::to_string(entry.points);
+    result.object["players"].type = Json::Type::VALUE;
+    result.object["players"].value = std::to_string(getLeaderboardSize(day));
+    return createResponse(OK, result);
+  };
+  leaderboard.next = &rank;
+
+  Route guess;
+  guess.path = "guess";
+  guess.method = Method::POST;
+  guess.handler = [&](const HttpObject& request) {
+    std::string game, guessed;
+    if (!validateRequestGuess(request, game, guessed)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    std::string token = request.headers.at("Authorization").substr(7);
+    JwtClaims claims;
+    if (!verifyJwt(token, claims)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt invalid";
+      return createResponse(FORBIDDEN, invalid);
+    }
+    std::string username = claims.username;
+    Day day = getCurrentDay();
+
+    GameSession session;
+    size_t round = 0;
+    if (getSession(username, day, session)) {
+      auto played = session.games.find(game);
+      if (played != session.games.end() &&
+          (played->second.solved || played->second.guesses.size() >= maxAttempts)) {
+        Json over;
+        over.type = Json::Type::VALUE;
+        over.value = "game over";
+        return createResponse(CONFLICT, over);
+      }
+      if (played != session.games.end()) round = played->second.guesses.size();
+    }
+
+    std::string answerId = getDailyAnimeId(day, *storage);
+    int64_t answerIndex = findCatalogIndex(answerId);
+    auto answer = answerIndex >= 0 ? getCatalogEntry(answerIndex) : nullptr;
+    bool correct;
+    if (game == "character") {
+      // only the answer's character among the ones shown this round counts,
+      // anything that is not a character id is a wrong guess
+      uint32_t character;
+      const char* end = guessed.data() + guessed.size();
+      auto parsed = std::from_chars(guessed.data(), end, character);
+      std::vector<uint32_t> shown = getDailyCharacterRound(day, round, *storage);
+      correct = answer && !guessed.empty() && parsed.ec == std::errc() && parsed.ptr == end &&
+        std::find(shown.begin(), shown.end(), character) != shown.end() &&
+        std::find(answer->characters.begin(), answer->characters.end(), character) != answer->characters.end();
+    } else {
+      correct = guessed == answerId;
+    }
+    GameProgress progress = recordGuess(username, day, game, guessed, correct);
+
+    Json result;
+    result.type = Json::Type::OBJECT;
+    result.object["correct"].type = Json::Type::VALUE;
+    result.object["correct"].value = correct ? "true" : "false";
+    result.object["attempts"].type = Json::Type::VALUE;
+    result.object["attempts"].value = std::to_string(progress.guesses.size());
+    result.object["solved"].type = Json::Type::VALUE;
+    result.object["solved"].value = progress.solved ? "true" : "false";
+    int64_t guessIndex = game == "character" ? -1 : findCatalogIndex(guessed);
+    auto guessEntry = guessIndex >= 0 ? getCatalogEntry(guessIndex) : nullptr;
+    if (guessEntry && answer) {
+      result.object["hints"] = evaluateGuess(*guessEntry, *answer);
+    }
+    return createResponse(OK, result);
+  };
+  rank.next = &guess;
+
+  Route progress;
+  progress.path = "progress";
+  progress.method = Method::GET;
+  progress.handler = [](const HttpObject& request) {
+    if (!validateRequestValidate(request)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    std::string token = request.headers.at("Authorization").substr(7);
+    JwtClaims claims;
+    if (!verifyJwt(token, claims)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt invalid";
+      return createResponse(FORBIDDEN, invalid);
+    }
+    Day day = getCurrentDay();
+    GameSession session;
+    getSession(claims.username, day, session);
+
+    Json result;
+    result.type = Json::Type::OBJECT;
+    result.object["day"].type = Json::Type::VALUE;
+    result.object["day"].value = formatDay(day);
+    result.object["games"].type = Json::Type::OBJECT;
+    for (const auto& [game, played] : session.games) {
+      Json gameJson;
+      gameJson.type = Json::Type::OBJECT;
+      gameJson.object["guesses"].type = Json::Type::ARRAY;
+      for (const auto& guessed : played.guesses) {
+        Json guessJson;
+        guessJson.type = Json::Type::VALUE;
+        guessJson.value = guessed;
+        gameJson.object["guesses"].array.push_back(guessJson);
+      }
+      gameJson.object["solved"].type = Json::Type::VALUE;
+      gameJson.object["solved"].value = played.solved ? "true" : "false";
+      result.object["games"].object[game] = gameJson;
+    }
+    return createResponse(OK, result);
+  };
+  guess.next = &progress;
+
+  Route revoke;
+  revoke.path = "revoke";
+  revoke.method = Method::POST;
+  revoke.handler = [&](const HttpObject& request) {
+    if (!validateRequestValidate(request)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "request not valid";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    std::string token = request.headers.at("Authorization").substr(7);
+    JwtClaims claims;
+    if (!verifyJwt(token, claims)) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt invalid";
+      return createResponse(FORBIDDEN, invalid);
+    }
+    if (claims.jti.empty()) {
+      Json invalid;
+      invalid.type = Json::Type::VALUE;
+      invalid.value = "jwt cannot be revoked";
+      return createResponse(BAD_REQUEST, invalid);
+    }
+    revokeToken(*storage, claims.jti, claims.expiresAt);
+    Json revoked;
+    revoked.type = Json::Type::VALUE;
+    revoked.value = "jwt revoked";
+    return createResponse(OK, revoked);
+  };
+  progress.next = &revoke;
+
+  Route metrics;
+  metrics.path = "metrics";
+  metrics.method = Method::GET;
+  metrics.handler = [](const HttpObject&) {
+    return createResponse(OK, "text/plain; version=0.0.4", renderMetrics());
+  };
+  revoke.next = &metrics;
+
   // end routes -------------------------------------------------------------------
 
   options.routes = &base;
+  registerRouteMetrics(&base);
+  configureTracing(traceEvery, traceSlowMs, traceFile);
+
+  startDailyScheduler(*storage, pregenerateDays);
+  loadLeaderboards(*storage, getCurrentDay());
+  loadSessions(*storage, getCurrentDay());
+  loadRevocations(*storage);
+  loadBans(*storage);
+  startScoreWriter(*storage);
+  startSessionWriter(*storage);
+  startPasswordHashers();
+  startRevocationSync(*storage);
+  startBanSync(*storage);
+  startIngestion(*storage);
 
   if (!logToFile) {
     createServer(options);
+    writeChromeTrace();
+    stopDailyScheduler();
+    stopScoreWriter();
+    stopSessionWriter();
+    stopPasswordHashers();
+    stopRevocationSync();
+    stopBanSync();
+    stopIngestion();
     return 0;
   }
 
-  auto logFile = std::make_shared<std::ofstream>("logs/backend", std::ios_base::app);
-  if (!logFile->is_open()) {
+  if (!startLogWriter("logs/backend")) {
     std::cerr << "Failed to open log file!\n";
     return 1;
   }
 
   {
-    initLogCout(logFile);
-    initLogCerr(logFile);
+    initLogCout();
+    initLogCerr();
 
     createServer(options);
+    writeChromeTrace();
+    stopDailyScheduler();
+    stopScoreWriter();
+    stopSessionWriter();
+    stopPasswordHashers();
+    stopRevocationSync();
+    stopBanSync();
+    stopIngestion();
   }
 
-  logFile->close();
+  stopLogWriter();
   return 0;
 }
 
@@ -0,0 +1,366 @@
+#include "storage.h"
+#include "day.h"
+#include "security.h"
+
+#include <chrono>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+
+// the collections as hash maps plus sorted indexes where the server reads
+// ranges, each behind its own lock; nothing survives a restart
+class MemoryStorage : public Storage {
+private:
+  std::shared_mutex usersMtx;
+  std::unordered_map<std::string, std::string> users;
+
+  std::mutex jwtMtx;
+  std::string jwtKey;
+
+  std::shared_mutex animeMtx;
+  std::vector<bsoncxx::document::value> anime; // natural order
+  std::unordered_map<std::string, size_t> animeByOid;
+  std::unordered_map<int64_t, size_t> animeByMalId;
+
+  std::shared_mutex dailiesMtx;
+  std::map<int32_t, bsoncxx::document::value> dailies; // by key
+
+  std::shared_mutex scoresMtx;
+  std::unordered_set<std::string> scoreKeys;
+  std::map<int32_t, std::vector<Score>> scoresByDay;
+
+  std::shared_mutex sessionsMtx;
+  std::unordered_map<std::string, GameSession> sessions;
+
+  std::shared_mutex revocationsMtx;
+  std::unordered_map<std::string, std::chrono::system_clock::time_point> revocations;
+
+  std::shared_mutex bansMtx;
+  std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> bans; // max() when permanent
+
+  void addAnime(const bsoncxx::document::view&);
+  void seed(const std::string&, const bsoncxx::document::view&);
+
+public:
+  explicit MemoryStorage(const std::string&);
+
+  bsoncxx::stdx::optional<std::string> findPassword(const std::string&) override;
+  bool insertUser(const std::string&, const std::string&) override;
+  void updatePassword(const std::string&, const std::string&) override;
+  std::string loadJwtKey() override;
+
+  size_t countAnime() override;
+  bsoncxx::stdx::optional<bsoncxx::document::value> findAnimeAt(size_t) override;
+  bsoncxx::stdx::optional<bsoncxx::document::value> findAnime(const bsoncxx::oid&) override;
+  std::vector<bsoncxx::document::value> findAnime(const std::vector<bsoncxx::oid>&) override;
+  void forEachAnime(const std::function<void(const bsoncxx::document::view&)>&) override;
+  std::unordered_map<int64_t, int64_t> findAnimeUpdates() override;
+  std::vector<bsoncxx::document::value> upsertAnime(const std::vector<bsoncxx::document::value>&) override;
+
+  bsoncxx::stdx::optional<bsoncxx::document::value> findDaily(Day) override;
+  bool insertDaily(const bsoncxx::document::view&) override;
+  std::vector<bsoncxx::document::value> findDailies(Day, Day) override;
+
+  void writeScores(const std::vector<Score>&) override;
+  std::vector<Score> findScores(Day) override;
+
+  std::vector<std::pair<std::string, GameSession>> findSessions(Day) override;
+  void writeSessions(const std::vector<std::pair<std::string, GameSession>>&) override;
+
+  bool insertRevocation(const std::string&, std::chrono::system_clock::time_point) override;
+  std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> findRevocations() override;
+
+  std::vector<std::string> findBans() override;
+};
+
+int64_t malIdOf(const bsoncxx::document::view& anime) {
+  auto id = anime["id"];
+  if (!id) return 0;
+  return id.type() == bsoncxx::type::k_int64 ? id.get_int64().value : id.get_int32().value;
+}
+
+// a copy of the document with the _id in front, as mongo stores it
+bsoncxx::document::value withObjectId(const bsoncxx::oid& id, const bsoncxx::document::view& document) {
+  using bsoncxx::builder::basic::kvp;
+
+  bsoncxx::builder::basic::document copy;
+  copy.append(kvp("_id", id));
+  for (auto&& element : document) {
+    if (element.key() != "_id") copy.append(kvp(element.key(), element.get_value()));
+  }
+  return copy.extract();
+}
+
+MemoryStorage::MemoryStorage(const std::string& seedPath) {
+  std::ifstream file(seedPath);
+  if (!file) {
+    std::cerr << "[memorystorage.cpp:MemoryStorage] cannot open seed " << seedPath << "\n";
+    throw std::runtime_error("MemoryStorage failed");
+  }
+
+  std::string line;
+  size_t number = 0;
+  size_t count = 0;
+  while (std::getline(file, line)) {
+    number++;
+    if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+    try {
+      auto entry = bsoncxx::from_json(line);
+      seed(std::string(entry.view()["collection"].get_string().value), entry.view()["document"].get_document().value);
+      count++;
+    } catch (const std::exception& e) {
+      std::cerr << "[memorystorage.cpp:MemoryStorage] " << seedPath << ":" << number << ": " << e.what() << "\n";
+    }
+  }
+  std::cout << "Seeded in-memory storage with " << count << " documents from " << seedPath << "\n";
+}
+
+// scores and sessions start empty, they are produced by the run itself
+void MemoryStorage::seed(const std::string& collection, const bsoncxx::document::view& document) {
+  if (collection == "users") {
+    users[std::string(document["username"].get_string().value)] = std::string(document["password"].get_string().value);
+  } else if (collection == "jwt") {
+    jwtKey = std::string(document["key"].get_string().value);
+  } else if (collection == "anime") {
+    addAnime(document);
+  } else if (collection == "dailies") {
+    int32_t key = document["key"].get_int32().value;
+    auto id = document["_id"] ? document["_id"].get_oid().value : bsoncxx::oid();
+    dailies.emplace(key, withObjectId(id, document));
+  } else if (collection == "revoked") {
+    revocations[std::string(document["jti"].get_string().value)] = std::chrono::system_clock::time_point(document["expiresAt"].get_date().value);
+  } else if (collection == "bans") {
+    auto until = document["until"];
+    bans.emplace_back(
+      std::string(document["ip"].get_string().value),
+      until ? std::chrono::system_clock::time_point(until.get_date().value) : std::chrono::system_clock::time_point::max()
+    );
+  } else {
+    throw std::runtime_error("unknown collection " + collection);
+  }
+}
+
+void MemoryStorage::addAnime(const bsoncxx::document::view& document) {
+  auto id = document["_id"] ? document["_id"].get_oid().value : bsoncxx::oid();
+  animeByOid[id.to_string()] = anime.size();
+  int64_t malId = malIdOf(document);
+  if (malId) animeByMalId[malId] = anime.size();
+  anime.push_back(withObjectId(id, document));
+}
+
+// users ----------------------------------------------------------------- users
+
+bsoncxx::stdx::optional<std::string> MemoryStorage::findPassword(const std::string& username) {
+  std::shared_lock<std::shared_mutex> lock(usersMtx);
+  auto it = users.find(username);
+  if (it == users.end()) return {};
+  return it->second;
+}
+
+bool MemoryStorage::insertUser(const std::string& username, const std::string& password) {
+  std::unique_lock<std::shared_mutex> lock(usersMtx);
+  return users.emplace(username, password).second;
+}
+
+void MemoryStorage::updatePassword(const std::string& username, const std::string& password) {
+  std::unique_lock<std::shared_mutex> lock(usersMtx);
+  auto it = users.find(username);
+  if (it != users.end()) it->second = password;
+}
+
+std::string MemoryStorage::loadJwtKey() {
+  std::lock_guard<std::mutex> lock(jwtMtx);
+  if (jwtKey.empty()) jwtKey = createJwtKey(32);
+  return jwtKey;
+}
+
+// anime ----------------------------------------------------------------- anime
+
+size_t MemoryStorage::countAnime() {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  return anime.size();
+}
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MemoryStorage::findAnimeAt(size_t position) {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  if (position >= anime.size()) return {};
+  return anime[position];
+}
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MemoryStorage::findAnime(const bsoncxx::oid& id) {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  auto it = animeByOid.find(id.to_string());
+  if (it == animeByOid.end()) return {};
+  return anime[it->second];
+}
+
+std::vector<bsoncxx::document::value> MemoryStorage::findAnime(const std::vector<bsoncxx::oid>& ids) {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  std::vector<bsoncxx::document::value> found;
+  for (const auto& id : ids) {
+    auto it = animeByOid.find(id.to_string());
+    if (it != animeByOid.end()) found.push_back(anime[it->second]);
+  }
+  return found;
+}
+
+void MemoryStorage::forEachAnime(const std::function<void(const bsoncxx::document::view&)>& visit) {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  for (const auto& document : anime) {
+    visit(document.view());
+  }
+}
+
+std::unordered_map<int64_t, int64_t> MemoryStorage::findAnimeUpdates() {
+  std::shared_lock<std::shared_mutex> lock(animeMtx);
+  std::unordered_map<int64_t, int64_t> updatedAt;
+  for (const auto& [malId, index] : animeByMalId) {
+    auto updated = anime[index].view()["updatedAt"];
+    updatedAt[malId] = updated && updated.type() == bsoncxx::type::k_date ? updated.get_date().value.count() : 0;
+  }
+  return updatedAt;
+}
+
+// like $set, fields of the stored document missing from the update are kept
+std::vector<bsoncxx::document::value> MemoryStorage::upsertAnime(const std::vector<bsoncxx::document::value>& batch) {
+  using bsoncxx::builder::basic::kvp;
+
+  std::unique_lock<std::shared_mutex> lock(animeMtx);
+  std::vector<bsoncxx::document::value> stored;
+  for (const auto& update : batch) {
+    int64_t malId = malIdOf(update.view());
+    auto it = animeByMalId.find(malId);
+    if (it == animeByMalId.end()) {
+      addAnime(update.view());
+      stored.push_back(anime.back());
+      continue;
+    }
+
+    auto previous = anime[it->second].view();
+    bsoncxx::builder::basic::document merged;
+    merged.append(kvp("_id", previous["_id"].get_oid()));
+    for (auto&& element : update.view()) {
+      if (element.key() != "_id") merged.append(kvp(element.key(), element.get_value()));
+    }
+    for (auto&& element : previous) {
+      if (element.key() != "_id" && !update.view()[element.key()]) merged.append(kvp(element.key(), element.get_value()));
+    }
+    anime[it->second] = merged.extract();
+    stored.push_back(anime[it->second]);
+  }
+  return stored;
+}
+
+// dailies ------------------------------------------------------------- dailies
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MemoryStorage::findDaily(Day day) {
+  std::shared_lock<std::shared_mutex> lock(dailiesMtx);
+  auto it = dailies.find(day.value);
+  if (it == dailies.end()) return {};
+  return it->second;
+}
+
+bool MemoryStorage::insertDaily(const bsoncxx::document::view& daily) {
+  int32_t key = daily["key"].get_int32().value;
+  std::unique_lock<std::shared_mutex> lock(dailiesMtx);
+  if (dailies.count(key)) return false;
+  dailies.emplace(key, withObjectId(bsoncxx::oid(), daily));
+  return true;
+}
+
+std::vector<bsoncxx::document::value> MemoryStorage::findDailies(Day from, Day to) {
+  std::shared_lock<std::shared_mutex> lock(dailiesMtx);
+  std::vector<bsoncxx::document::value> found;
+  for (auto it = dailies.lower_bound(from.value); it != dailies.end() && it->first <= to.value; ++it) {
+    found.push_back(it->second);
+  }
+  return found;
+}
+
+// scores --------------------------------------------------------------- scores
+
+void MemoryStorage::writeScores(const std::vector<Score>& batch) {
+  std::unique_lock<std::shared_mutex> lock(scoresMtx);
+  for (const auto& score : batch) {
+    if (scoreKeys.insert(score.key).second) {
+      scoresByDay[score.day.value].push_back(score);
+    }
+  }
+}
+
+std::vector<Score> MemoryStorage::findScores(Day from) {
+  std::shared_lock<std::shared_mutex> lock(scoresMtx);
+  std::vector<Score> found;
+  for (auto it = scoresByDay.lower_bound(from.value); it != scoresByDay.end(); ++it) {
+    found.insert(found.end(), it->second.begin(), it->second.end());
+  }
+  return found;
+}
+
+// sessions ----------------------------------------------------------- sessions
+
+std::vector<std::pair<std::string, GameSession>> MemoryStorage::findSessions(Day day) {
+  std::shared_lock<std::shared_mutex> lock(sessionsMtx);
+  std::vector<std::pair<std::string, GameSession>> found;
+  for (const auto& [username, session] : sessions) {
+    if (session.day == day) found.emplace_back(username, session);
+  }
+  return found;
+}
+
+void MemoryStorage::writeSessions(const std::vector<std::pair<std::string, GameSession>>& changed) {
+  std::unique_lock<std::shared_mutex> lock(sessionsMtx);
+  for (const auto& [username, session] : changed) {
+    sessions[username] = session;
+  }
+}
+
+// revocations and bans ----------------------------------------------------- bans
+
+bool MemoryStorage::insertRevocation(const std::string& jti, std::chrono::system_clock::time_point expiresAt) {
+  std::unique_lock<std::shared_mutex> lock(revocationsMtx);
+  return revocations.emplace(jti, expiresAt).second;
+}
+
+std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> MemoryStorage::findRevocations() {
+  auto now = std::chrono::system_clock::now();
+  std::unique_lock<std::shared_mutex> lock(revocationsMtx);
+  std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> found;
+  for (auto it = revocations.begin(); it != revocations.end();) {
+    if (it->second <= now) {
+      it = revocations.erase(it);
+    } else {
+      found.emplace_back(*it);
+      ++it;
+    }
+  }
+  return found;
+}
+
+std::vector<std::string> MemoryStorage::findBans() {
+  auto now = std::chrono::system_clock::now();
+  std::shared_lock<std::shared_mutex> lock(bansMtx);
+  std::vector<std::string> found;
+  for (const auto& [ip, until] : bans) {
+    if (until > now) found.push_back(ip);
+  }
+  return found;
+}
+
+std::unique_ptr<Storage> createMemoryStorage(const std::string& seedPath) {
+  return std::make_unique<MemoryStorage>(seedPath);
+}
@@ -0,0 +1,384 @@
+#include "metrics.h"
+#include "client.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+constexpr size_t maxRouteMetrics = 64;
+
+// log-linear buckets over microseconds as in HDR histograms, values below 8
+// get a bucket each, above that every power of two is split in 8, which
+// bounds the error to 12.5% up to 2^34 microseconds
+constexpr size_t subBucketCount = 8;
+constexpr size_t histogramBuckets = subBucketCount + 31 * subBucketCount;
+
+constexpr int trackedStatuses[] = { 200, 202, 304, 400, 401, 403, 404, 409, 429, 500, 503 };
+constexpr size_t statusSlots = sizeof(trackedStatuses) / sizeof(trackedStatuses[0]) + 1;
+
+const char* const mongoCommands[] = {
+  "find", "getMore", "insert", "update", "delete", "findAndModify", "aggregate",
+  "count", "createIndexes", "listCollections", "create"
+};
+constexpr size_t mongoSlots = sizeof(mongoCommands) / sizeof(mongoCommands[0]) + 1;
+
+const char* const cacheNames[] = { "jwt", "api_response", "conditional", "upstream_connection" };
+constexpr size_t cacheSlots = sizeof(cacheNames) / sizeof(cacheNames[0]);
+
+const char* const rejectionNames[] = { "banned", "rate_limited" };
+constexpr size_t rejectionSlots = sizeof(rejectionNames) / sizeof(rejectionNames[0]);
+
+// boundaries exported to Prometheus, the HDR buckets are folded into them
+constexpr double exportedBounds[] = {
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+constexpr double exportedQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+using Counter = std::atomic<uint64_t>;
+
+// each live shard has a single writer, the owning thread
+void bump(Counter& counter, uint64_t amount = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void addTo(Counter& to, const Counter& from) {
+  bump(to, from.load(std::memory_order_relaxed));
+}
+
+size_t bucketOf(uint64_t micros) {
+  if (micros < subBucketCount) return micros;
+  unsigned exponent = 63 - __builtin_clzll(micros);
+  size_t index = (exponent - 2) * subBucketCount + ((micros >> (exponent - 3)) & (subBucketCount - 1));
+  return std::min(index, histogramBuckets - 1);
+}
+
+// exclusive upper bound of the bucket in microseconds
+uint64_t bucketUpperBound(size_t index) {
+  if (index < subBucketCount) return index + 1;
+  unsigned exponent = index / subBucketCount + 2;
+  uint64_t sub = index % subBucketCount + subBucketCount;
+  return (sub + 1) << (exponent - 3);
+}
+
+struct Histogram {
+  std::array<Counter, histogramBuckets> counts{};
+  Counter sumMicros{ 0 };
+
+  void record(uint64_t micros) {
+    bump(counts[bucketOf(micros)]);
+    bump(sumMicros, micros);
+  }
+
+  void mergeInto(Histogram& to) const {
+    for (size_t i = 0; i < histogramBuckets; i++) {
+      addTo(to.counts[i], counts[i]);
+    }
+    addTo(to.sumMicros, sumMicros);
+  }
+};
+
+struct RouteSlot {
+  Histogram latency;
+  std::array<Counter, statusSlots> statuses{};
+  Counter bytesIn{ 0 };
+  Counter bytesOut{ 0 };
+};
+
+// written by the threads serving requests
+struct RequestShard {
+  std::array<RouteSlot, maxRouteMetrics> routes;
+  Counter accepted{ 0 };
+  std::array<Counter, rejectionSlots> rejected{};
+
+  void mergeInto(RequestShard& to) const {
+    for (size_t i = 0; i < maxRouteMetrics; i++) {
+      routes[i].latency.mergeInto(to.routes[i].latency);
+      for (size_t s = 0; s < statusSlots; s++) {
+        addTo(to.routes[i].statuses[s], routes[i].statuses[s]);
+      }
+      addTo(to.routes[i].bytesIn, routes[i].bytesIn);
+      addTo(to.routes[i].bytesOut, routes[i].bytesOut);
+    }
+    addTo(to.accepted, accepted);
+    for (size_t r = 0; r < rejectionSlots; r++) {
+      addTo(to.rejected[r], rejected[r]);
+    }
+  }
+};
+
+// written by any thread that talks to mongo or looks up a cache
+struct BackendShard {
+  std::array<Histogram, mongoSlots> mongo;
+  std::array<Counter, mongoSlots> mongoFailures{};
+  std::array<std::array<Counter, 2>, cacheSlots> cache{}; // misses, hits
+
+  void mergeInto(BackendShard& to) const {
+    for (size_t i = 0; i < mongoSlots; i++) {
+      mongo[i].mergeInto(to.mongo[i]);
+      addTo(to.mongoFailures[i], mongoFailures[i]);
+    }
+    for (size_t i = 0; i < cacheSlots; i++) {
+      addTo(to.cache[i][0], cache[i][0]);
+      addTo(to.cache[i][1], cache[i][1]);
+    }
+  }
+};
+
+// shards of finished threads are folded into retired so counters never go back
+template <typename Shard>
+struct ShardRegistry {
+  std::mutex mtx;
+  std::vector<std::shared_ptr<Shard>> live;
+  Shard retired;
+
+  std::unique_ptr<Shard> merge() {
+    auto total = std::make_unique<Shard>();
+    std::lock_guard<std::mutex> lock(mtx);
+    retired.mergeInto(*total);
+    for (const auto& shard : live) {
+      shard->mergeInto(*total);
+    }
+    return total;
+  }
+};
+
+ShardRegistry<RequestShard> requestShards;
+ShardRegistry<BackendShard> backendShards;
+
+template <typename Shard>
+struct ShardHandle {
+  ShardRegistry<Shard>& registry;
+  std::shared_ptr<Shard> shard;
+
+  ~ShardHandle() {
+    if (!shard) return;
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    shard->mergeInto(registry.retired);
+    registry.live.erase(std::find(registry.live.begin(), registry.live.end(), shard));
+  }
+};
+
+template <typename Shard>
+Shard& localShard(ShardRegistry<Shard>& registry) {
+  thread_local ShardHandle<Shard> handle{ registry, nullptr };
+  if (!handle.shard) {
+    handle.shard = std::make_shared<Shard>();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.live.push_back(handle.shard);
+  }
+  return *handle.shard;
+}
+
+std::vector<std::string> routeLabels = { "unmatched" };
+std::atomic<int64_t> openConnections(0);
+
+void labelRoutes(Route* route, const std::string& parent) {
+  for (; route != nullptr; route = route->next) {
+    std::string label = parent + "/" + route->path;
+    if (routeLabels.size() < maxRouteMetrics) {
+      route->metricsIndex = static_cast<int>(routeLabels.size());
+      routeLabels.push_back(label);
+    }
+    labelRoutes(route->nested, label == "/" ? "" : label);
+  }
+}
+
+void registerRouteMetrics(Route* root) {
+  labelRoutes(root, "");
+}
+
+void recordConnectionOpened() {
+  openConnections++;
+  bump(localShard(requestShards).accepted);
+}
+
+void recordConnectionClosed() {
+  openConnections--;
+}
+
+void recordRejectedConnection(Rejection rejection) {
+  bump(localShard(requestShards).rejected[static_cast<size_t>(rejection)]);
+}
+
+void recordRequest(int routeIndex, int status, size_t bytesIn, size_t bytesOut, std::chrono::steady_clock::duration elapsed) {
+  size_t index = routeIndex >= 0 && routeIndex < static_cast<int>(maxRouteMetrics) ? routeIndex : 0;
+  RouteSlot& slot = localShard(requestShards).routes[index];
+
+  size_t statusSlot = statusSlots - 1;
+  for (size_t i = 0; i + 1 < statusSlots; i++) {
+    if (trackedStatuses[i] == status) {
+      statusSlot = i;
+      break;
+    }
+  }
+  bump(slot.statuses[statusSlot]);
+  bump(slot.bytesIn, bytesIn);
+  bump(slot.bytesOut, bytesOut);
+  slot.latency.record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+void recordMongoCommand(const std::string& command, int64_t micros, bool succeeded) {
+  size_t slot = mongoSlots - 1;
+  for (size_t i = 0; i + 1 < mongoSlots; i++) {
+    if (command == mongoCommands[i]) {
+      slot = i;
+      break;
+    }
+  }
+  BackendShard& shard = localShard(backendShards);
+  shard.mongo[slot].record(micros > 0 ? micros : 0);
+  if (!succeeded) bump(shard.mongoFailures[slot]);
+}
+
+void recordCacheLookup(CacheKind kind, bool hit) {
+  bump(localShard(backendShards).cache[static_cast<size_t>(kind)][hit ? 1 : 0]);
+}
+
+void appendMetric(std::string& out, const char* name, const std::string& labels, double value) {
+  char buffer[64];
+  std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+  out += name;
+  if (!labels.empty()) {
+    out += "{" + labels + "}";
+  }
+  out += " ";
+  out += buffer;
+  out += "\n";
+}
+
+void appendType(std::string& out, const char* name, const char* help, const char* type) {
+  out += "# HELP ";
+  out += name;
+  out += " ";
+  out += help;
+  out += "\n# TYPE ";
+  out += name;
+  out += " ";
+  out += type;
+  out += "\n";
+}
+
+uint64_t histogramCount(const Histogram& histogram) {
+  uint64_t count = 0;
+  for (const auto& bucket : histogram.counts) {
+    count += bucket.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+// upper bound of the bucket holding the quantile, in seconds
+double histogramQuantile(const Histogram& histogram, uint64_t count, double quantile) {
+  uint64_t rank = static_cast<uint64_t>(quantile * count);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < histogramBuckets; i++) {
+    seen += histogram.counts[i].load(std::memory_order_relaxed);
+    if (seen > rank) return bucketUpperBound(i) / 1e6;
+  }
+  return bucketUpperBound(histogramBuckets - 1) / 1e6;
+}
+
+void appendHistogram(std::string& out, const std::string& name, const std::string& labels, const Histogram& histogram) {
+  std::string prefix = labels.empty() ? "" : labels + ",";
+  uint64_t cumulative = 0;
+  size_t bucket = 0;
+  for (double bound : exportedBounds) {
+    uint64_t limit = static_cast<uint64_t>(bound * 1e6 + 0.5);
+    while (bucket < histogramBuckets && bucketUpperBound(bucket) <= limit) {
+      cumulative += histogram.counts[bucket++].load(std::memory_order_relaxed);
+    }
+    char le[32];
+    std::snprintf(le, sizeof(le), "le=\"%g\"", bound);
+    appendMetric(out, (name + "_bucket").c_str(), prefix + le, cumulative);
+  }
+  uint64_t count = histogramCount(histogram);
+  appendMetric(out, (name + "_bucket").c_str(), prefix + "le=\"+Inf\"", count);
+  appendMetric(out, (name + "_sum").c_str(), labels, histogram.sumMicros.load(std::memory_order_relaxed) / 1e6);
+  appendMetric(out, (name + "_count").c_str(), labels, count);
+}
+
+std::string renderMetrics() {
+  auto requests = requestShards.merge();
+  auto backend = backendShards.merge();
+  std::string out;
+  out.reserve(64 * 1024);
+
+  appendType(out, "anidle_http_requests_total", "Requests answered, by route and status.", "counter");
+  for (size_t i = 0; i < routeLabels.size(); i++) {
+    for (size_t s = 0; s < statusSlots; s++) {
+      uint64_t count = requests->routes[i].statuses[s].load();
+      if (count == 0) continue;
+      std::string status = s + 1 < statusSlots ? std::to_string(trackedStatuses[s]) : "other";
+      appendMetric(out, "anidle_http_requests_total", "route=\"" + routeLabels[i] + "\",status=\"" + status + "\"", count);
+    }
+  }
+
+  appendType(out, "anidle_http_request_duration_seconds", "Time from accept to response sent.", "histogram");
+  for (size_t i = 0; i < routeLabels.size(); i++) {
+    appendHistogram(out, "anidle_http_request_duration_seconds", "route=\"" + routeLabels[i] + "\"", requests->routes[i].latency);
+  }
+
+  appendType(out, "anidle_http_request_duration_quantile_seconds", "Latency quantiles from the merged histograms, within 12.5%.", "gauge");
+  for (size_t i = 0; i < routeLabels.size(); i++) {
+    uint64_t count = histogramCount(requests->routes[i].latency);
+    if (count == 0) continue;
+    for (double quantile : exportedQuantiles) {
+      char label[32];
+      std::snprintf(label, sizeof(label), ",quantile=\"%g\"", quantile);
+      appendMetric(out, "anidle_http_request_duration_quantile_seconds", "route=\"" + routeLabels[i] + "\"" + label,
+        histogramQuantile(requests->routes[i].latency, count, quantile));
+    }
+  }
+
+  appendType(out, "anidle_http_received_bytes_total", "Request bytes read, by route.", "counter");
+  for (size_t i = 0; i < routeLabels.size(); i++) {
+    appendMetric(out, "anidle_http_received_bytes_total", "route=\"" + routeLabels[i] + "\"", requests->routes[i].bytesIn.load());
+  }
+  appendType(out, "anidle_http_sent_bytes_total", "Response bytes sent, by route.", "counter");
+  for (size_t i = 0; i < routeLabels.size(); i++) {
+    appendMetric(out, "anidle_http_sent_bytes_total", "route=\"" + routeLabels[i] + "\"", requests->routes[i].bytesOut.load());
+  }
+
+  appendType(out, "anidle_connections_accepted_total", "Client connections accepted.", "counter");
+  appendMetric(out, "anidle_connections_accepted_total", "", requests->accepted.load());
+  appendType(out, "anidle_connections_rejected_total", "Client connections refused with a 429.", "counter");
+  for (size_t r = 0; r < rejectionSlots; r++) {
+    appendMetric(out, "anidle_connections_rejected_total", std::string("reason=\"") + rejectionNames[r] + "\"", requests->rejected[r].load());
+  }
+  appendType(out, "anidle_connections_open", "Client connections currently open.", "gauge");
+  appendMetric(out, "anidle_connections_open", "", openConnections.load());
+  appendType(out, "anidle_upstream_idle_connections", "Keep-alive connections pooled for upstream requests.", "gauge");
+  appendMetric(out, "anidle_upstream_idle_connections", "", idleConnectionCount());
+
+  appendType(out, "anidle_mongo_command_duration_seconds", "Mongo command latency reported by the driver.", "histogram");
+  for (size_t i = 0; i < mongoSlots; i++) {
+    if (histogramCount(backend->mongo[i]) == 0) continue;
+    std::string command = i + 1 < mongoSlots ? mongoCommands[i] : "other";
+    appendHistogram(out, "anidle_mongo_command_duration_seconds", "command=\"" + command + "\"", backend->mongo[i]);
+  }
+  appendType(out, "anidle_mongo_command_failures_total", "Mongo commands that failed.", "counter");
+  for (size_t i = 0; i < mongoSlots; i++) {
+    std::string command = i + 1 < mongoSlots ? mongoCommands[i] : "other";
+    appendMetric(out, "anidle_mongo_command_failures_total", "command=\"" + command + "\"", backend->mongoFailures[i].load());
+  }
+
+  appendType(out, "anidle_cache_hits_total", "Cache lookups answered from the cache.", "counter");
+  for (size_t i = 0; i < cacheSlots; i++) {
+    appendMetric(out, "anidle_cache_hits_total", std::string("cache=\"") + cacheNames[i] + "\"", backend->cache[i][1].load());
+  }
+  appendType(out, "anidle_cache_misses_total", "Cache lookups that missed.", "counter");
+  for (size_t i = 0; i < cacheSlots; i++) {
+    appendMetric(out, "anidle_cache_misses_total", std::string("cache=\"") + cacheNames[i] + "\"", backend->cache[i][0].load());
+  }
+  appendType(out, "anidle_cache_hit_ratio", "Hits over lookups since start.", "gauge");
+  for (size_t i = 0; i < cacheSlots; i++) {
+    uint64_t hits = backend->cache[i][1].load();
+    uint64_t lookups = hits + backend->cache[i][0].load();
+    appendMetric(out, "anidle_cache_hit_ratio", std::string("cache=\"") + cacheNames[i] + "\"", lookups ? double(hits) / lookups : 0);
+  }
+  return out;
+}
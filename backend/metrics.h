@@ -0,0 +1,43 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "types.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class CacheKind {
+  JWT,
+  API_RESPONSE,
+  CONDITIONAL,
+  UPSTREAM_CONNECTION
+};
+
+enum class Rejection {
+  BANNED,
+  RATE_LIMITED
+};
+
+// counters and latency histograms live in per-thread shards written without
+// locks, a scrape merges the shards so its cost depends on the number of
+// threads and routes, never on the number of requests
+
+// labels every route of the tree with its full path, requests that matched
+// no route are counted under index 0
+void registerRouteMetrics(Route*);
+
+void recordConnectionOpened();
+void recordConnectionClosed();
+void recordRejectedConnection(Rejection);
+// route metrics index, status, bytes in, bytes out, time since accept
+void recordRequest(int, int, size_t, size_t, std::chrono::steady_clock::duration);
+// command name, duration in microseconds, succeeded
+void recordMongoCommand(const std::string&, int64_t, bool);
+void recordCacheLookup(CacheKind, bool);
+
+// Prometheus text exposition format
+std::string renderMetrics();
+
+#endif // METRICS_H
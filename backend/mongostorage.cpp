@@ -0,0 +1,456 @@
+#include "storage.h"
+#include "db.h"
+#include "day.h"
+#include "security.h"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/client.hpp>
+#include <mongocxx/exception/exception.hpp>
+#include <mongocxx/exception/operation_exception.hpp>
+#include <mongocxx/model/replace_one.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/model/write.hpp>
+#include <mongocxx/options/bulk_write.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/pool.hpp>
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_array;
+using bsoncxx::builder::basic::make_document;
+
+constexpr size_t sessionBatchSize = 500;
+
+// every call acquires its own client from the pool, so handlers and
+// background threads can share one instance
+class MongoStorage : public Storage {
+private:
+  std::unique_ptr<mongocxx::pool> pool;
+  std::string dbName;
+
+  void migrateDailies(mongocxx::database&);
+
+public:
+  MongoStorage(const std::string&, const std::string&);
+
+  bsoncxx::stdx::optional<std::string> findPassword(const std::string&) override;
+  bool insertUser(const std::string&, const std::string&) override;
+  void updatePassword(const std::string&, const std::string&) override;
+  std::string loadJwtKey() override;
+
+  size_t countAnime() override;
+  bsoncxx::stdx::optional<bsoncxx::document::value> findAnimeAt(size_t) override;
+  bsoncxx::stdx::optional<bsoncxx::document::value> findAnime(const bsoncxx::oid&) override;
+  std::vector<bsoncxx::document::value> findAnime(const std::vector<bsoncxx::oid>&) override;
+  void forEachAnime(const std::function<void(const bsoncxx::document::view&)>&) override;
+  std::unordered_map<int64_t, int64_t> findAnimeUpdates() override;
+  std::vector<bsoncxx::document::value> upsertAnime(const std::vector<bsoncxx::document::value>&) override;
+
+  bsoncxx::stdx::optional<bsoncxx::document::value> findDaily(Day) override;
+  bool insertDaily(const bsoncxx::document::view&) override;
+  std::vector<bsoncxx::document::value> findDailies(Day, Day) override;
+
+  void writeScores(const std::vector<Score>&) override;
+  std::vector<Score> findScores(Day) override;
+
+  std::vector<std::pair<std::string, GameSession>> findSessions(Day) override;
+  void writeSessions(const std::vector<std::pair<std::string, GameSession>>&) override;
+
+  bool insertRevocation(const std::string&, std::chrono::system_clock::time_point) override;
+  std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> findRevocations() override;
+
+  std::vector<std::string> findBans() override;
+};
+
+MongoStorage::MongoStorage(const std::string& uri, const std::string& name) : pool(createDBPool(uri)), dbName(name) {
+  auto client = pool->acquire();
+  mongocxx::database db = (*client)[dbName];
+  for (const char* collection : { "users", "dailies", "scores", "sessions", "jwt", "revoked", "bans" }) {
+    createCollection(db, collection);
+  }
+
+  migrateDailies(db);
+  db["dailies"].create_index(make_document(kvp("key", 1)), make_document(kvp("unique", true)));
+  db["scores"].create_index(make_document(kvp("key", 1)), make_document(kvp("unique", true)));
+  db["scores"].create_index(make_document(kvp("day", 1), kvp("points", -1)));
+  db["sessions"].create_index(make_document(kvp("username", 1)), make_document(kvp("unique", true)));
+  db["revoked"].create_index(make_document(kvp("jti", 1)), make_document(kvp("unique", true)));
+  // mongo deletes each document once its expiresAt has passed
+  db["revoked"].create_index(make_document(kvp("expiresAt", 1)), make_document(kvp("expireAfterSeconds", 0)));
+  // registrations hash concurrently, the index is what keeps usernames unique
+  try {
+    db["users"].create_index(make_document(kvp("username", 1)), make_document(kvp("unique", true)));
+  } catch (const mongocxx::exception& e) {
+    std::cerr << "[mongostorage.cpp:MongoStorage] " << e.what() << "\n";
+  }
+  try {
+    db["anime"].create_index(make_document(kvp("id", 1)), make_document(kvp("unique", true)));
+  } catch (const mongocxx::exception& e) {
+    std::cerr << "[mongostorage.cpp:MongoStorage] " << e.what() << "\n";
+  }
+}
+
+// dailies are keyed by "key" (days since epoch); older entries only carry "day"
+void MongoStorage::migrateDailies(mongocxx::database& db) {
+  auto dailies = db["dailies"];
+  auto missing = dailies.find(make_document(kvp("key", make_document(kvp("$exists", false)))));
+  for (auto&& daily : missing) {
+    Day day;
+    std::string str(daily["day"].get_string().value);
+    if (!parseDay(str, day)) {
+      std::cerr << "[mongostorage.cpp:migrateDailies] invalid day \"" << str << "\"\n";
+      continue;
+    }
+    dailies.update_one(
+      make_document(kvp("_id", daily["_id"].get_oid())),
+      make_document(kvp("$set", make_document(kvp("key", day.value))))
+    );
+  }
+}
+
+// users ----------------------------------------------------------------- users
+
+bsoncxx::stdx::optional<std::string> MongoStorage::findPassword(const std::string& username) {
+  auto client = pool->acquire();
+  auto result = (*client)[dbName]["users"].find_one(make_document(kvp("username", username)));
+  if (!result) return {};
+  auto stored = result->view()["password"];
+  if (!stored || stored.type() != bsoncxx::type::k_string) return {};
+  return std::string(stored.get_string().value);
+}
+
+bool MongoStorage::insertUser(const std::string& username, const std::string& password) {
+  auto client = pool->acquire();
+  try {
+    (*client)[dbName]["users"].insert_one(make_document(kvp("username", username), kvp("password", password)));
+    return true;
+  } catch (const mongocxx::operation_exception& e) {
+    // duplicate key, the username is taken
+    if (e.code().value() == 11000) return false;
+    std::cerr << "[mongostorage.cpp:insertUser] " << username << ": " << e.what() << "\n";
+    throw;
+  }
+}
+
+void MongoStorage::updatePassword(const std::string& username, const std::string& password) {
+  auto client = pool->acquire();
+  (*client)[dbName]["users"].update_one(
+    make_document(kvp("username", username)),
+    make_document(kvp("$set", make_document(kvp("password", password))))
+  );
+}
+
+std::string MongoStorage::loadJwtKey() {
+  auto client = pool->acquire();
+  auto jwt = (*client)[dbName]["jwt"];
+  if (jwt.count_documents({}) == 0) {
+    jwt.insert_one(make_document(kvp("key", createJwtKey(32))));
+  }
+  auto token = jwt.find_one({});
+  return token ? std::string(token->view()["key"].get_string().value) : "";
+}
+
+// anime ----------------------------------------------------------------- anime
+
+size_t MongoStorage::countAnime() {
+  auto client = pool->acquire();
+  return static_cast<size_t>((*client)[dbName]["anime"].count_documents({}));
+}
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MongoStorage::findAnimeAt(size_t position) {
+  auto client = pool->acquire();
+  mongocxx::options::find options{};
+  options.skip(static_cast<int64_t>(position)).limit(1);
+  for (auto&& anime : (*client)[dbName]["anime"].find({}, options)) {
+    return bsoncxx::document::value(anime);
+  }
+  return {};
+}
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MongoStorage::findAnime(const bsoncxx::oid& id) {
+  auto client = pool->acquire();
+  return (*client)[dbName]["anime"].find_one(make_document(kvp("_id", id)));
+}
+
+std::vector<bsoncxx::document::value> MongoStorage::findAnime(const std::vector<bsoncxx::oid>& ids) {
+  bsoncxx::builder::basic::array in;
+  for (const auto& id : ids) {
+    in.append(id);
+  }
+  auto client = pool->acquire();
+  std::vector<bsoncxx::document::value> found;
+  for (auto&& anime : (*client)[dbName]["anime"].find(make_document(kvp("_id", make_document(kvp("$in", in.extract())))))) {
+    found.emplace_back(anime);
+  }
+  return found;
+}
+
+void MongoStorage::forEachAnime(const std::function<void(const bsoncxx::document::view&)>& visit) {
+  auto client = pool->acquire();
+  for (auto&& anime : (*client)[dbName]["anime"].find({})) {
+    visit(anime);
+  }
+}
+
+std::unordered_map<int64_t, int64_t> MongoStorage::findAnimeUpdates() {
+  auto client = pool->acquire();
+  std::unordered_map<int64_t, int64_t> updatedAt;
+  mongocxx::options::find options{};
+  options.projection(make_document(kvp("_id", 0), kvp("id", 1), kvp("updatedAt", 1)));
+  for (auto&& anime : (*client)[dbName]["anime"].find(make_document(kvp("id", make_document(kvp("$exists", true)))), options)) {
+    auto id = anime["id"];
+    int64_t malId = id.type() == bsoncxx::type::k_int64 ? id.get_int64().value : id.get_int32().value;
+    auto updated = anime["updatedAt"];
+    updatedAt[malId] = updated && updated.type() == bsoncxx::type::k_date ? updated.get_date().value.count() : 0;
+  }
+  return updatedAt;
+}
+
+std::vector<bsoncxx::document::value> MongoStorage::upsertAnime(const std::vector<bsoncxx::document::value>& batch) {
+  std::vector<mongocxx::model::write> writes;
+  bsoncxx::builder::basic::array ids;
+  writes.reserve(batch.size());
+  for (const auto& anime : batch) {
+    auto id = anime.view()["id"].get_int32().value;
+    mongocxx::model::update_one upsert(
+      make_document(kvp("id", id)),
+      make_document(kvp("$set", anime.view()))
+    );
+    upsert.upsert(true);
+    writes.emplace_back(std::move(upsert));
+    ids.append(id);
+  }
+
+  auto client = pool->acquire();
+  auto collection = (*client)[dbName]["anime"];
+  mongocxx::options::bulk_write options;
+  options.ordered(false);
+  collection.bulk_write(writes, options);
+
+  std::vector<bsoncxx::document::value> stored;
+  for (auto&& anime : collection.find(make_document(kvp("id", make_document(kvp("$in", ids.extract())))))) {
+    stored.emplace_back(anime);
+  }
+  return stored;
+}
+
+// dailies ------------------------------------------------------------- dailies
+
+bsoncxx::stdx::optional<bsoncxx::document::value> MongoStorage::findDaily(Day day) {
+  auto client = pool->acquire();
+  return (*client)[dbName]["dailies"].find_one(make_document(kvp("key", day.value)));
+}
+
+bool MongoStorage::insertDaily(const bsoncxx::document::view& daily) {
+  auto client = pool->acquire();
+  try {
+    (*client)[dbName]["dailies"].insert_one(daily);
+    return true;
+  } catch (const mongocxx::exception& e) {
+    std::cerr << "[mongostorage.cpp:insertDaily] " << e.what() << "\n";
+    return false;
+  }
+}
+
+std::vector<bsoncxx::document::value> MongoStorage::findDailies(Day from, Day to) {
+  auto client = pool->acquire();
+  mongocxx::options::find options{};
+  options.sort(make_document(kvp("key", 1)));
+  std::vector<bsoncxx::document::value> found;
+  auto range = (*client)[dbName]["dailies"].find(
+    make_document(kvp("key", make_document(kvp("$gte", from.value), kvp("$lte", to.value)))),
+    options
+  );
+  for (auto&& daily : range) {
+    found.emplace_back(daily);
+  }
+  return found;
+}
+
+// scores --------------------------------------------------------------- scores
+
+// upserts with $setOnInsert so a replayed batch never overwrites or double counts
+void MongoStorage::writeScores(const std::vector<Score>& batch) {
+  std::vector<mongocxx::model::write> writes;
+  writes.reserve(batch.size());
+  for (const auto& score : batch) {
+    mongocxx::model::update_one upsert(
+      make_document(kvp("key", score.key)),
+      make_document(kvp("$setOnInsert", make_document(
+        kvp("key", score.key),
+        kvp("username", score.username),
+        kvp("day", score.day.value),
+        kvp("game", score.game),
+        kvp("attempts", score.attempts),
+        kvp("solved", score.solved),
+        kvp("points", score.points),
+        kvp("submittedAt", bsoncxx::types::b_date(std::chrono::milliseconds(score.submittedAt)))
+      )))
+    );
+    upsert.upsert(true);
+    writes.emplace_back(std::move(upsert));
+  }
+
+  auto client = pool->acquire();
+  mongocxx::options::bulk_write options;
+  options.ordered(false);
+  (*client)[dbName]["scores"].bulk_write(writes, options);
+}
+
+std::vector<Score> MongoStorage::findScores(Day from) {
+  auto client = pool->acquire();
+  mongocxx::options::find byDay{};
+  byDay.sort(make_document(kvp("day", 1)));
+  std::vector<Score> scores;
+  auto found = (*client)[dbName]["scores"].find(
+    make_document(kvp("day", make_document(kvp("$gte", from.value)))),
+    byDay
+  );
+  for (auto&& document : found) {
+    Score score;
+    score.key = std::string(document["key"].get_string().value);
+    score.username = std::string(document["username"].get_string().value);
+    score.day = Day(document["day"].get_int32().value);
+    score.game = std::string(document["game"].get_string().value);
+    score.attempts = document["attempts"].get_int32().value;
+    score.solved = document["solved"].get_bool().value;
+    score.points = document["points"].get_int32().value;
+    score.submittedAt = document["submittedAt"].get_date().value.count();
+    scores.push_back(std::move(score));
+  }
+  return scores;
+}
+
+// sessions ----------------------------------------------------------- sessions
+
+std::vector<std::pair<std::string, GameSession>> MongoStorage::findSessions(Day day) {
+  auto client = pool->acquire();
+  std::vector<std::pair<std::string, GameSession>> sessions;
+  for (auto&& document : (*client)[dbName]["sessions"].find(make_document(kvp("day", day.value)))) {
+    try {
+      GameSession session;
+      session.day = day;
+      for (auto&& game : document["games"].get_document().value) {
+        GameProgress progress;
+        auto gameDoc = game.get_document().value;
+        for (auto&& guess : gameDoc["guesses"].get_array().value) {
+          progress.guesses.emplace_back(guess.get_string().value);
+        }
+        progress.solved = gameDoc["solved"].get_bool().value;
+        session.games.emplace(std::string(game.key()), std::move(progress));
+      }
+      sessions.emplace_back(std::string(document["username"].get_string().value), std::move(session));
+    } catch (const std::exception& e) {
+      std::cerr << "[mongostorage.cpp:findSessions] " << e.what() << "\n";
+    }
+  }
+  return sessions;
+}
+
+bsoncxx::document::value createSessionDocument(const std::string& username, const GameSession& session) {
+  bsoncxx::builder::basic::document games;
+  for (const auto& [game, progress] : session.games) {
+    bsoncxx::builder::basic::array guesses;
+    for (const auto& guess : progress.guesses) {
+      guesses.append(guess);
+    }
+    games.append(kvp(game, make_document(
+      kvp("guesses", guesses.extract()),
+      kvp("solved", progress.solved)
+    )));
+  }
+  return make_document(
+    kvp("username", username),
+    kvp("day", session.day.value),
+    kvp("games", games.extract()),
+    kvp("updatedAt", bsoncxx::types::b_date(std::chrono::system_clock::now()))
+  );
+}
+
+void MongoStorage::writeSessions(const std::vector<std::pair<std::string, GameSession>>& sessions) {
+  auto client = pool->acquire();
+  auto collection = (*client)[dbName]["sessions"];
+  for (size_t start = 0; start < sessions.size(); start += sessionBatchSize) {
+    size_t end = std::min(sessions.size(), start + sessionBatchSize);
+    std::vector<mongocxx::model::write> writes;
+    writes.reserve(end - start);
+    for (size_t i = start; i < end; i++) {
+      mongocxx::model::replace_one replace(
+        make_document(kvp("username", sessions[i].first)),
+        createSessionDocument(sessions[i].first, sessions[i].second)
+      );
+      replace.upsert(true);
+      writes.emplace_back(std::move(replace));
+    }
+    mongocxx::options::bulk_write options;
+    options.ordered(false);
+    collection.bulk_write(writes, options);
+  }
+}
+
+// revocations and bans ----------------------------------------------------- bans
+
+bool MongoStorage::insertRevocation(const std::string& jti, std::chrono::system_clock::time_point expiresAt) {
+  auto client = pool->acquire();
+  try {
+    (*client)[dbName]["revoked"].insert_one(make_document(
+      kvp("jti", jti),
+      kvp("expiresAt", bsoncxx::types::b_date(expiresAt))
+    ));
+    return true;
+  } catch (const mongocxx::exception& e) {
+    // already revoked, the unique index rejected the duplicate
+    std::cerr << "[mongostorage.cpp:insertRevocation] " << jti << ": " << e.what() << "\n";
+    return false;
+  }
+}
+
+// the TTL monitor runs about once a minute, so expiry is filtered here as well
+std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> MongoStorage::findRevocations() {
+  auto client = pool->acquire();
+  auto now = bsoncxx::types::b_date(std::chrono::system_clock::now());
+  std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> revocations;
+  for (auto&& document : (*client)[dbName]["revoked"].find(make_document(kvp("expiresAt", make_document(kvp("$gt", now)))))) {
+    try {
+      revocations.emplace_back(
+        std::string(document["jti"].get_string().value),
+        std::chrono::system_clock::time_point(document["expiresAt"].get_date().value)
+      );
+    } catch (const std::exception& e) {
+      std::cerr << "[mongostorage.cpp:findRevocations] " << e.what() << "\n";
+    }
+  }
+  return revocations;
+}
+
+// bans are documents { ip: "a.b.c.d", until: date }, without until the ban is permanent
+std::vector<std::string> MongoStorage::findBans() {
+  auto client = pool->acquire();
+  auto now = bsoncxx::types::b_date(std::chrono::system_clock::now());
+  auto filter = make_document(kvp("$or", make_array(
+    make_document(kvp("until", make_document(kvp("$exists", false)))),
+    make_document(kvp("until", make_document(kvp("$gt", now))))
+  )));
+  std::vector<std::string> bans;
+  for (auto&& document : (*client)[dbName]["bans"].find(filter.view())) {
+    auto ip = document["ip"];
+    if (ip && ip.type() == bsoncxx::type::k_string) {
+      bans.emplace_back(ip.get_string().value);
+    }
+  }
+  return bans;
+}
+
+std::unique_ptr<Storage> createMongoStorage(const std::string& uri, const std::string& dbName) {
+  return std::make_unique<MongoStorage>(uri, dbName);
+}
@@ -0,0 +1,102 @@
+#include "passwords.h"
+#include "security.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// every hash holds scrypt's memory for its duration, so the pool stays small
+// and a burst beyond the queue is refused instead of piling up
+constexpr size_t maxPasswordHashers = 4;
+constexpr size_t maxQueuedPasswordJobs = 64;
+
+std::mutex passwordMtx;
+std::condition_variable passwordCv;
+std::deque<std::function<void()>> passwordJobs;
+bool passwordHashersRunning = false;
+std::vector<std::thread> passwordHashers;
+
+void passwordHasherLoop() {
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(passwordMtx);
+      passwordCv.wait(lock, [] { return !passwordHashersRunning || !passwordJobs.empty(); });
+      if (passwordJobs.empty()) break;
+      job = std::move(passwordJobs.front());
+      passwordJobs.pop_front();
+    }
+    job();
+  }
+}
+
+bool submitPasswordJob(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(passwordMtx);
+    if (!passwordHashersRunning || passwordJobs.size() >= maxQueuedPasswordJobs) return false;
+    passwordJobs.push_back(std::move(job));
+  }
+  passwordCv.notify_one();
+  return true;
+}
+
+bool hashPasswordAsync(const std::string& password, std::function<void(const std::string&)> done) {
+  return submitPasswordJob([password, done = std::move(done)] {
+    std::string hash;
+    try {
+      hash = hashPassword(password);
+    } catch (const std::exception& e) {
+      std::cerr << "[passwords.cpp:hashPasswordAsync] " << e.what() << "\n";
+    }
+    done(hash);
+  });
+}
+
+bool checkPasswordAsync(const std::string& password, const std::string& stored, std::function<void(const PasswordCheck&)> done) {
+  return submitPasswordJob([password, stored, done = std::move(done)] {
+    PasswordCheck check;
+    try {
+      bool outdated = false;
+      check.matches = verifyPassword(password, stored, outdated);
+      if (check.matches && outdated) {
+        check.rehashed = hashPassword(password);
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "[passwords.cpp:checkPasswordAsync] " << e.what() << "\n";
+      check = PasswordCheck();
+      check.failed = true;
+    }
+    done(check);
+  });
+}
+
+void startPasswordHashers() {
+  size_t count = std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, maxPasswordHashers);
+  {
+    std::lock_guard<std::mutex> lock(passwordMtx);
+    passwordHashersRunning = true;
+  }
+  for (size_t i = 0; i < count; i++) {
+    passwordHashers.emplace_back(passwordHasherLoop);
+  }
+}
+
+// queued jobs are finished so every accepted callback is called
+void stopPasswordHashers() {
+  {
+    std::lock_guard<std::mutex> lock(passwordMtx);
+    passwordHashersRunning = false;
+  }
+  passwordCv.notify_all();
+  for (auto& hasher : passwordHashers) {
+    hasher.join();
+  }
+  passwordHashers.clear();
+}
@@ -0,0 +1,25 @@
+#ifndef PASSWORDS_H
+#define PASSWORDS_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+struct PasswordCheck {
+  bool matches = false;
+  std::string rehashed; // new hash to store when the old one was legacy or outdated
+  bool failed = false;
+};
+
+// password hashing runs on a few dedicated threads behind a bounded queue, the
+// callback is called on a hasher thread so the caller never waits for scrypt;
+// false when the queue is full, the callback is then never called
+void startPasswordHashers();
+void stopPasswordHashers();
+
+// the hash is empty when hashing failed
+bool hashPasswordAsync(const std::string&, std::function<void(const std::string&)>);
+// password, stored hash
+bool checkPasswordAsync(const std::string&, const std::string&, std::function<void(const PasswordCheck&)>);
+
+#endif // PASSWORDS_H
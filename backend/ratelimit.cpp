@@ -0,0 +1,178 @@
+#include "ratelimit.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <arpa/inet.h>
+
+struct RouteBudget {
+  const char* route;
+  double perSecond;
+  double burst;
+};
+
+// credential routes get a small budget, everything else is only kept from flooding
+constexpr RouteBudget routeBudgets[] = {
+  { "login", 0.2, 10 },
+  { "register", 0.05, 5 },
+  { "refresh", 0.5, 10 },
+  { "revoke", 0.5, 10 },
+};
+constexpr size_t routeBudgetCount = sizeof(routeBudgets) / sizeof(routeBudgets[0]);
+constexpr RouteBudget defaultBudget = { "", 20, 40 };
+
+constexpr size_t limiterShardCount = 16;
+constexpr size_t maxBucketsPerShard = 16384;
+constexpr auto banSyncInterval = std::chrono::seconds(30);
+
+struct RateBucket {
+  double tokens;
+  std::chrono::steady_clock::time_point updatedAt;
+};
+
+struct LimiterShard {
+  std::mutex mtx;
+  std::unordered_map<uint64_t, RateBucket> buckets; // address << 8 | budget index
+};
+
+std::array<LimiterShard, limiterShardCount> limiterShards;
+std::atomic<bool> rateLimiting(true);
+
+std::shared_mutex bansMtx;
+std::unordered_set<uint32_t> bannedIps;
+
+std::mutex banSyncMtx;
+std::condition_variable banSyncCv;
+std::atomic<bool> banSyncRunning(false);
+std::thread banSyncThread;
+
+// "POST /login/... HTTP/1.1" gives the budget of "login"
+size_t budgetIndexOf(const std::string& data) {
+  size_t start = data.find(' ');
+  if (start == std::string::npos) return routeBudgetCount;
+  start++;
+  while (start < data.size() && data[start] == '/') start++;
+  size_t end = start;
+  while (end < data.size() && data[end] != '/' && data[end] != '?' && data[end] != ' ' && data[end] != '\r') end++;
+
+  for (size_t i = 0; i < routeBudgetCount; i++) {
+    size_t length = std::strlen(routeBudgets[i].route);
+    if (length == end - start && data.compare(start, length, routeBudgets[i].route) == 0) return i;
+  }
+  return routeBudgetCount;
+}
+
+const RouteBudget& budgetAt(size_t index) {
+  return index < routeBudgetCount ? routeBudgets[index] : defaultBudget;
+}
+
+double refill(const RateBucket& bucket, const RouteBudget& budget, std::chrono::steady_clock::time_point now) {
+  double elapsed = std::chrono::duration<double>(now - bucket.updatedAt).count();
+  return std::min(budget.burst, bucket.tokens + elapsed * budget.perSecond);
+}
+
+// buckets that refilled completely carry no state and are dropped first, then
+// arbitrary ones until a quarter of the shard is free so a flood of new
+// addresses does not scan the shard on every connection
+void pruneBuckets(LimiterShard& shard, std::chrono::steady_clock::time_point now) {
+  for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+    const RouteBudget& budget = budgetAt(it->first & 0xff);
+    it = refill(it->second, budget, now) >= budget.burst ? shard.buckets.erase(it) : std::next(it);
+  }
+  while (shard.buckets.size() > maxBucketsPerShard * 3 / 4) {
+    shard.buckets.erase(shard.buckets.begin());
+  }
+}
+
+bool allowRequest(uint32_t ip, const std::string& data) {
+  if (!rateLimiting.load(std::memory_order_relaxed)) return true;
+  size_t index = budgetIndexOf(data);
+  const RouteBudget& budget = budgetAt(index);
+  uint64_t key = uint64_t(ip) << 8 | index;
+  auto now = std::chrono::steady_clock::now();
+
+  LimiterShard& shard = limiterShards[(ip * 0x9e3779b1u) >> 28];
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.buckets.find(key);
+  if (it == shard.buckets.end()) {
+    if (shard.buckets.size() >= maxBucketsPerShard) pruneBuckets(shard, now);
+    shard.buckets.emplace(key, RateBucket{ budget.burst - 1, now });
+    return true;
+  }
+  RateBucket& bucket = it->second;
+  bucket.tokens = refill(bucket, budget, now);
+  bucket.updatedAt = now;
+  if (bucket.tokens < 1) return false;
+  bucket.tokens -= 1;
+  return true;
+}
+
+void setRateLimiting(bool enabled) {
+  rateLimiting = enabled;
+}
+
+bool isIpBanned(uint32_t ip) {
+  std::shared_lock<std::shared_mutex> lock(bansMtx);
+  return bannedIps.count(ip) > 0;
+}
+
+void loadBans(Storage& storage) {
+  std::unordered_set<uint32_t> loaded;
+  for (const auto& address : storage.findBans()) {
+    in_addr parsed;
+    if (inet_pton(AF_INET, address.c_str(), &parsed) != 1) {
+      std::cerr << "[ratelimit.cpp:loadBans] invalid ip \"" << address << "\"\n";
+      continue;
+    }
+    loaded.insert(ntohl(parsed.s_addr));
+  }
+
+  std::unique_lock<std::shared_mutex> lock(bansMtx);
+  bannedIps = std::move(loaded);
+}
+
+void banSyncLoop(Storage& storage) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(banSyncMtx);
+      banSyncCv.wait_for(lock, banSyncInterval, [] { return !banSyncRunning; });
+      if (!banSyncRunning) break;
+    }
+    try {
+      loadBans(storage);
+    } catch (const std::exception& e) {
+      std::cerr << "[ratelimit.cpp:banSyncLoop] " << e.what() << "\n";
+    }
+  }
+}
+
+void startBanSync(Storage& storage) {
+  banSyncRunning = true;
+  banSyncThread = std::thread(banSyncLoop, std::ref(storage));
+}
+
+void stopBanSync() {
+  {
+    std::lock_guard<std::mutex> lock(banSyncMtx);
+    banSyncRunning = false;
+  }
+  banSyncCv.notify_all();
+  if (banSyncThread.joinable()) {
+    banSyncThread.join();
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <cstdint>
+#include <string>
+
+class Storage;
+
+// addresses are IPv4 in host byte order
+
+// bans are read from storage, addresses as "a.b.c.d"
+void loadBans(Storage&);
+bool isIpBanned(uint32_t);
+
+// takes a token from the bucket of the address and the route named in the
+// request line of the raw request, without parsing the rest of it
+bool allowRequest(uint32_t, const std::string&);
+// on by default, load tests from a single address turn it off
+void setRateLimiting(bool);
+
+void startBanSync(Storage&);
+void stopBanSync();
+
+#endif // RATELIMIT_H
@@ -0,0 +1,141 @@
+#include "revoke.h"
+#include "storage.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+// 4 Mi bits per filter keeps false positives low well past 200k live revocations,
+// the size is fixed so a reader still probing the previous filter never sees it freed
+constexpr size_t bloomWords = (size_t(1) << 22) / 64;
+constexpr int bloomProbes = 6;
+constexpr auto revocationSyncInterval = std::chrono::seconds(10);
+
+struct BloomFilter {
+  std::array<std::atomic<uint64_t>, bloomWords> words{};
+
+  void clear() {
+    for (auto& word : words) {
+      word.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// readers probe the active filter without locking, rebuilds fill the other
+// one and swap; only a probe hit takes the lock to consult the exact set
+std::array<BloomFilter, 2> bloomFilters;
+std::atomic<BloomFilter*> activeBloom(&bloomFilters[0]);
+
+std::shared_mutex revokedMtx;
+std::unordered_map<std::string, std::chrono::system_clock::time_point> revokedTokens;
+
+std::mutex revocationSyncMtx;
+std::condition_variable revocationSyncCv;
+std::atomic<bool> revocationSyncRunning(false);
+std::thread revocationSyncThread;
+
+template <typename F>
+void forEachBloomBit(const std::string& jti, F&& f) {
+  uint64_t first = std::hash<std::string>{}(jti);
+  // splitmix64 finalizer for the second hash of the double hashing
+  uint64_t second = first + 0x9e3779b97f4a7c15ULL;
+  second = (second ^ (second >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  second = (second ^ (second >> 27)) * 0x94d049bb133111ebULL;
+  second = (second ^ (second >> 31)) | 1;
+  for (int i = 0; i < bloomProbes; i++) {
+    uint64_t bit = (first + i * second) % (bloomWords * 64);
+    f(bit / 64, uint64_t(1) << (bit % 64));
+  }
+}
+
+void addToBloom(BloomFilter& filter, const std::string& jti) {
+  forEachBloomBit(jti, [&](size_t word, uint64_t mask) {
+    filter.words[word].fetch_or(mask, std::memory_order_relaxed);
+  });
+}
+
+bool mayBeRevoked(const BloomFilter& filter, const std::string& jti) {
+  bool present = true;
+  forEachBloomBit(jti, [&](size_t word, uint64_t mask) {
+    present = present && (filter.words[word].load(std::memory_order_relaxed) & mask);
+  });
+  return present;
+}
+
+void loadRevocations(Storage& storage) {
+  auto now = std::chrono::system_clock::now();
+  std::unordered_map<std::string, std::chrono::system_clock::time_point> loaded;
+  for (auto& [jti, expiresAt] : storage.findRevocations()) {
+    loaded.emplace(std::move(jti), expiresAt);
+  }
+
+  std::unique_lock<std::shared_mutex> lock(revokedMtx);
+  // revocations made here since the query started are kept until they expire
+  for (const auto& [jti, expiresAt] : revokedTokens) {
+    if (expiresAt > now) loaded.emplace(jti, expiresAt);
+  }
+  BloomFilter* next = activeBloom.load() == &bloomFilters[0] ? &bloomFilters[1] : &bloomFilters[0];
+  next->clear();
+  for (const auto& entry : loaded) {
+    addToBloom(*next, entry.first);
+  }
+  revokedTokens = std::move(loaded);
+  activeBloom.store(next, std::memory_order_release);
+}
+
+void revokeToken(Storage& storage, const std::string& jti, std::chrono::system_clock::time_point expiresAt) {
+  // false when already revoked, the entry is refreshed below either way
+  storage.insertRevocation(jti, expiresAt);
+
+  std::unique_lock<std::shared_mutex> lock(revokedMtx);
+  revokedTokens[jti] = expiresAt;
+  addToBloom(*activeBloom.load(), jti);
+}
+
+bool isRevoked(const std::string& jti) {
+  if (jti.empty() || !mayBeRevoked(*activeBloom.load(std::memory_order_acquire), jti)) return false;
+
+  std::shared_lock<std::shared_mutex> lock(revokedMtx);
+  return revokedTokens.count(jti) > 0;
+}
+
+void revocationSyncLoop(Storage& storage) {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(revocationSyncMtx);
+      revocationSyncCv.wait_for(lock, revocationSyncInterval, [] { return !revocationSyncRunning; });
+      if (!revocationSyncRunning) break;
+    }
+    try {
+      loadRevocations(storage);
+    } catch (const std::exception& e) {
+      std::cerr << "[revoke.cpp:revocationSyncLoop] " << e.what() << "\n";
+    }
+  }
+}
+
+void startRevocationSync(Storage& storage) {
+  revocationSyncRunning = true;
+  revocationSyncThread = std::thread(revocationSyncLoop, std::ref(storage));
+}
+
+void stopRevocationSync() {
+  {
+    std::lock_guard<std::mutex> lock(revocationSyncMtx);
+    revocationSyncRunning = false;
+  }
+  revocationSyncCv.notify_all();
+  if (revocationSyncThread.joinable()) {
+    revocationSyncThread.join();
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef REVOKE_H
+#define REVOKE_H
+
+#include <chrono>
+#include <string>
+
+class Storage;
+
+// revoked token ids are stored until the token's exp and are mirrored in
+// memory as a Bloom filter in front of an exact set
+void loadRevocations(Storage&);
+
+// jti, exp of the token
+void revokeToken(Storage&, const std::string&, std::chrono::system_clock::time_point);
+bool isRevoked(const std::string&);
+
+// picks up revocations made by other instances and drops expired ones
+void startRevocationSync(Storage&);
+void stopRevocationSync();
+
+#endif // REVOKE_H
@@ -0,0 +1,164 @@
+#include "scores.h"
+#include "day.h"
+#include "leaderboard.h"
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// scores are acknowledged once queued, the writer thread flushes them with
+// one write when a batch fills up or at least once a second
+constexpr size_t scoreQueueCapacity = 10000;
+constexpr size_t scoreBatchSize = 256;
+constexpr auto scoreFlushInterval = std::chrono::seconds(1);
+// failed writes back off exponentially; a score that failed once is retried
+// alone from the back of the queue so one bad document cannot hold back the
+// rest, and dropped after maxScoreAttempts
+constexpr auto minScoreBackoff = std::chrono::seconds(1);
+constexpr auto maxScoreBackoff = std::chrono::seconds(60);
+constexpr int maxScoreAttempts = 8;
+
+struct PendingScore {
+  Score score;
+  int attempts = 0;
+};
+
+std::mutex scoreMtx;
+std::condition_variable scoreCv;
+std::deque<PendingScore> scoreQueue;
+std::map<Day, std::unordered_set<std::string>> submittedKeys;
+std::atomic<bool> scoreWriterRunning(false);
+std::thread scoreWriterThread;
+
+ScoreSubmission submitScore(const Score& score) {
+  {
+    std::lock_guard<std::mutex> lock(scoreMtx);
+    auto& keys = submittedKeys[score.day];
+    if (keys.find(score.key) != keys.end()) {
+      return ScoreSubmission::DUPLICATE;
+    }
+    if (scoreQueue.size() >= scoreQueueCapacity) {
+      return ScoreSubmission::QUEUE_FULL;
+    }
+    keys.insert(score.key);
+    // only the last two days can still receive scores
+    while (submittedKeys.begin()->first < score.day - 1) {
+      submittedKeys.erase(submittedKeys.begin());
+    }
+
+    scoreQueue.push_back(PendingScore{ score, 0 });
+    if (scoreQueue.size() >= scoreBatchSize) {
+      scoreCv.notify_one();
+    }
+  }
+
+  recordLeaderboardScore(score.day, score.username, score.points, score.submittedAt);
+  return ScoreSubmission::ACCEPTED;
+}
+
+void restoreSubmittedScore(Day day, const std::string& key) {
+  std::lock_guard<std::mutex> lock(scoreMtx);
+  submittedKeys[day].insert(key);
+}
+
+// kept in the log so the score can be replayed by hand; the key and the
+// leaderboard points go so the player can submit again. Called with scoreMtx held
+void dropScore(const PendingScore& pending, const char* reason) {
+  const Score& score = pending.score;
+  auto keys = submittedKeys.find(score.day);
+  if (keys != submittedKeys.end()) keys->second.erase(score.key);
+  removeLeaderboardScore(score.day, score.username, score.points);
+  std::cerr << "[scores.cpp:dropScore] " << reason << " after " << pending.attempts << " attempts: key=" << score.key
+    << " username=" << score.username << " day=" << formatDay(score.day) << " game=" << score.game
+    << " attempts=" << score.attempts << " solved=" << score.solved << " points=" << score.points
+    << " submittedAt=" << score.submittedAt << "\n";
+}
+
+void scoreWriterLoop(Storage& storage) {
+  auto backoff = std::chrono::steady_clock::duration::zero();
+  while (true) {
+    std::vector<PendingScore> batch;
+    {
+      std::unique_lock<std::mutex> lock(scoreMtx);
+      if (backoff > std::chrono::steady_clock::duration::zero()) {
+        scoreCv.wait_for(lock, backoff, [] { return !scoreWriterRunning.load(); });
+      } else {
+        scoreCv.wait_for(lock, scoreFlushInterval, [] {
+          return !scoreWriterRunning || scoreQueue.size() >= scoreBatchSize ||
+            (!scoreQueue.empty() && scoreQueue.front().attempts > 0);
+        });
+      }
+      if (scoreQueue.empty()) {
+        if (!scoreWriterRunning) break;
+        continue;
+      }
+      size_t count = 1;
+      if (scoreQueue.front().attempts == 0) {
+        size_t limit = std::min(scoreQueue.size(), scoreBatchSize);
+        while (count < limit && scoreQueue[count].attempts == 0) count++;
+      }
+      batch.assign(std::make_move_iterator(scoreQueue.begin()), std::make_move_iterator(scoreQueue.begin() + count));
+      scoreQueue.erase(scoreQueue.begin(), scoreQueue.begin() + count);
+    }
+
+    std::vector<Score> scores;
+    scores.reserve(batch.size());
+    for (const auto& pending : batch) {
+      scores.push_back(pending.score);
+    }
+    try {
+      storage.writeScores(scores);
+      backoff = std::chrono::steady_clock::duration::zero();
+    } catch (const std::exception& e) {
+      std::cerr << "[scores.cpp:scoreWriterLoop] " << batch.size() << " scores not written: " << e.what() << "\n";
+      backoff = backoff == std::chrono::steady_clock::duration::zero() ? std::chrono::steady_clock::duration(minScoreBackoff)
+        : std::min<std::chrono::steady_clock::duration>(backoff * 2, maxScoreBackoff);
+
+      std::lock_guard<std::mutex> lock(scoreMtx);
+      // put them back behind the others, upserts make the retry safe; while
+      // shutting down every score gets a single try
+      for (auto& pending : batch) {
+        pending.attempts++;
+        if (!scoreWriterRunning) {
+          dropScore(pending, "shutdown");
+        } else if (pending.attempts >= maxScoreAttempts) {
+          dropScore(pending, "write failed");
+        } else if (scoreQueue.size() < scoreQueueCapacity) {
+          scoreQueue.push_back(std::move(pending));
+        } else {
+          dropScore(pending, "queue full");
+        }
+      }
+    }
+  }
+}
+
+void startScoreWriter(Storage& storage) {
+  scoreWriterRunning = true;
+  scoreWriterThread = std::thread(scoreWriterLoop, std::ref(storage));
+}
+
+// flushes what is left in the queue before returning
+void stopScoreWriter() {
+  {
+    std::lock_guard<std::mutex> lock(scoreMtx);
+    scoreWriterRunning = false;
+  }
+  scoreCv.notify_all();
+  if (scoreWriterThread.joinable()) {
+    scoreWriterThread.join();
+  }
+}
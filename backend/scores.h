@@ -0,0 +1,37 @@
+#ifndef SCORES_H
+#define SCORES_H
+
+#include "day.h"
+
+#include <cstdint>
+#include <string>
+
+struct Score {
+  std::string key; // idempotency key, one score per user, day and game
+  std::string username;
+  Day day;
+  std::string game;
+  int attempts;
+  bool solved;
+  int points;
+  int64_t submittedAt; // unix time in milliseconds
+};
+
+enum class ScoreSubmission {
+  ACCEPTED,
+  DUPLICATE,
+  QUEUE_FULL
+};
+
+
+// queues the score for the background writer, returns without touching mongo
+ScoreSubmission submitScore(const Score&);
+// marks a score already in the collection as submitted, used when rebuilding state
+void restoreSubmittedScore(Day, const std::string&);
+
+class Storage;
+
+void startScoreWriter(Storage&);
+void stopScoreWriter();
+
+#endif // SCORES_H
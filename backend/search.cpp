@@ -0,0 +1,209 @@
+#include "search.h"
+#include "catalog.h"
+#include "text.h"
+
+#include <algorithm>
+#include <climits>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+// radix trie over folded titles, every node keeps the most popular entries
+// of its subtree so a prefix query is a walk plus a copy
+struct SearchNode {
+  std::string label; // edge from the parent
+  std::vector<uint32_t> children; // sorted by the first byte of their label
+  std::vector<uint32_t> entries; // entries with a title ending here
+  std::vector<uint32_t> top; // at most searchTopK, most popular first
+};
+
+std::shared_mutex searchMtx;
+std::vector<SearchNode> searchNodes(1);
+std::vector<int> searchPopularity; // by catalog index
+
+bool ranksBefore(uint32_t a, uint32_t b) {
+  if (searchPopularity[a] != searchPopularity[b]) return searchPopularity[a] < searchPopularity[b];
+  return a < b;
+}
+
+void addTop(SearchNode& node, uint32_t entry) {
+  auto& top = node.top;
+  if (std::find(top.begin(), top.end(), entry) != top.end()) return;
+  if (top.size() == searchTopK && !ranksBefore(entry, top.back())) return;
+  top.insert(std::upper_bound(top.begin(), top.end(), entry, ranksBefore), entry);
+  if (top.size() > searchTopK) top.pop_back();
+}
+
+void recomputeTop(SearchNode& node) {
+  std::vector<uint32_t> candidates = node.entries;
+  for (uint32_t child : node.children) {
+    const auto& childTop = searchNodes[child].top;
+    candidates.insert(candidates.end(), childTop.begin(), childTop.end());
+  }
+  std::sort(candidates.begin(), candidates.end(), ranksBefore);
+  candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+  if (candidates.size() > searchTopK) candidates.resize(searchTopK);
+  node.top = std::move(candidates);
+}
+
+// index of the child whose label starts with c, or the insert position as ~index
+int64_t findChild(const SearchNode& node, char c) {
+  auto it = std::lower_bound(node.children.begin(), node.children.end(), c,
+    [](uint32_t child, char value) { return searchNodes[child].label[0] < value; });
+  if (it != node.children.end() && searchNodes[*it].label[0] == c) return it - node.children.begin();
+  return ~(it - node.children.begin());
+}
+
+void insertKey(const std::string& key, uint32_t entry) {
+  std::vector<uint32_t> path = { 0 };
+  uint32_t node = 0;
+  size_t pos = 0;
+
+  while (pos < key.size()) {
+    int64_t slot = findChild(searchNodes[node], key[pos]);
+    if (slot < 0) {
+      SearchNode leaf;
+      leaf.label = key.substr(pos);
+      uint32_t leafIndex = static_cast<uint32_t>(searchNodes.size());
+      searchNodes.push_back(std::move(leaf));
+      auto& children = searchNodes[node].children;
+      children.insert(children.begin() + ~slot, leafIndex);
+      node = leafIndex;
+      path.push_back(node);
+      break;
+    }
+
+    uint32_t child = searchNodes[node].children[slot];
+    const std::string& label = searchNodes[child].label;
+    size_t common = 0;
+    while (common < label.size() && pos + common < key.size() && label[common] == key[pos + common]) {
+      common++;
+    }
+
+    if (common < label.size()) {
+      // split the edge, the new middle node takes over the child's place
+      SearchNode middle;
+      middle.label = label.substr(0, common);
+      middle.children.push_back(child);
+      middle.top = searchNodes[child].top;
+      searchNodes[child].label.erase(0, common);
+      uint32_t middleIndex = static_cast<uint32_t>(searchNodes.size());
+      searchNodes.push_back(std::move(middle));
+      searchNodes[node].children[slot] = middleIndex;
+      child = middleIndex;
+    }
+
+    node = child;
+    pos += common;
+    path.push_back(node);
+  }
+
+  searchNodes[node].entries.push_back(entry);
+  for (uint32_t visited : path) {
+    addTop(searchNodes[visited], entry);
+  }
+}
+
+void removeKey(const std::string& key, uint32_t entry) {
+  std::vector<uint32_t> path = { 0 };
+  uint32_t node = 0;
+  size_t pos = 0;
+
+  while (pos < key.size()) {
+    int64_t slot = findChild(searchNodes[node], key[pos]);
+    if (slot < 0) return;
+    node = searchNodes[node].children[slot];
+    const std::string& label = searchNodes[node].label;
+    if (key.compare(pos, label.size(), label) != 0) return;
+    pos += label.size();
+    path.push_back(node);
+  }
+
+  auto& entries = searchNodes[node].entries;
+  auto it = std::find(entries.begin(), entries.end(), entry);
+  if (it == entries.end()) return;
+  entries.erase(it);
+
+  for (auto visited = path.rbegin(); visited != path.rend(); ++visited) {
+    auto& top = searchNodes[*visited].top;
+    if (std::find(top.begin(), top.end(), entry) != top.end()) {
+      recomputeTop(searchNodes[*visited]);
+    }
+  }
+}
+
+// every folded title, from the start and from the start of each word
+std::set<std::string> indexKeys(const CatalogEntry& entry) {
+  std::set<std::string> keys;
+  auto addTitle = [&](const std::string& title) {
+    std::string folded = foldCase(title);
+    for (size_t start = 0; start < folded.size(); start = folded.find(' ', start) + 1) {
+      keys.insert(folded.substr(start));
+      if (folded.find(' ', start) == std::string::npos) break;
+    }
+  };
+
+  addTitle(entry.title);
+  addTitle(entry.english);
+  for (const auto& synonym : entry.synonyms) {
+    addTitle(synonym);
+  }
+  keys.erase("");
+  return keys;
+}
+
+void updateSearchIndex(uint32_t index, const CatalogEntry* previous, const CatalogEntry& entry) {
+  std::set<std::string> previousKeys;
+  if (previous) {
+    previousKeys = indexKeys(*previous);
+  }
+  std::set<std::string> keys = indexKeys(entry);
+
+  std::unique_lock<std::shared_mutex> lock(searchMtx);
+  if (searchPopularity.size() <= index) {
+    searchPopularity.resize(index + 1, INT_MAX);
+  }
+
+  if (previous && previous->popularity != entry.popularity) {
+    // rank changed, reindex every title so the top lists stay ordered
+    for (const auto& key : previousKeys) {
+      removeKey(key, index);
+    }
+    previousKeys.clear();
+  }
+  for (const auto& key : previousKeys) {
+    if (keys.find(key) == keys.end()) {
+      removeKey(key, index);
+    }
+  }
+
+  searchPopularity[index] = entry.popularity;
+  for (const auto& key : keys) {
+    if (previousKeys.find(key) == previousKeys.end()) {
+      insertKey(key, index);
+    }
+  }
+}
+
+std::vector<uint32_t> searchTitles(const std::string& query, size_t limit) {
+  std::string key = foldCase(query);
+  if (key.empty()) return {};
+
+  std::shared_lock<std::shared_mutex> lock(searchMtx);
+  uint32_t node = 0;
+  size_t pos = 0;
+  while (pos < key.size()) {
+    int64_t slot = findChild(searchNodes[node], key[pos]);
+    if (slot < 0) return {};
+    node = searchNodes[node].children[slot];
+    const std::string& label = searchNodes[node].label;
+    size_t length = std::min(label.size(), key.size() - pos);
+    if (key.compare(pos, length, label, 0, length) != 0) return {};
+    pos += length;
+  }
+
+  const auto& top = searchNodes[node].top;
+  return std::vector<uint32_t>(top.begin(), top.begin() + std::min(limit, top.size()));
+}
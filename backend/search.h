@@ -0,0 +1,19 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "catalog.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr size_t searchTopK = 10;
+
+// replaces the titles indexed for a catalog entry (previous is null for new entries)
+void updateSearchIndex(uint32_t, const CatalogEntry*, const CatalogEntry&);
+
+// catalog indexes of the most popular entries with a title, or a word of a
+// title, starting with the query
+std::vector<uint32_t> searchTitles(const std::string&, size_t);
+
+#endif // SEARCH_H
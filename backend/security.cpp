@@ -1,9 +1,21 @@
 #include "security.h"
+#include "metrics.h"
+#include "revoke.h"
 #include "jwt-cpp/jwt.h"
 
 #include <vector>
 #include <stdexcept>
+#include <array>
+#include <charconv>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <cstddef>
 #include <cstdlib>
 #include <exception>
@@ -16,46 +28,304 @@
 #include <openssl/rand.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
+#include <openssl/crypto.h>
 
 std::string jwtKey;
+std::string jwtIssuer;
+
+// built once per key, verification then only decodes and checks the token
+using JwtVerifier = decltype(jwt::verify());
+std::unique_ptr<JwtVerifier> jwtVerifier;
+
+// tokens that passed verification, kept with their claims until they expire
+constexpr size_t jwtCacheShardCount = 16;
+constexpr size_t jwtCacheShardCapacity = 4096;
+
+struct JwtCacheShard {
+  std::mutex mtx;
+  std::unordered_map<std::string, JwtClaims> tokens;
+};
+
+std::array<JwtCacheShard, jwtCacheShardCount> jwtCache;
+
+JwtCacheShard& jwtCacheShardOf(const std::string& token) {
+  return jwtCache[std::hash<std::string>{}(token) % jwtCacheShardCount];
+}
+
+void clearJwtCache() {
+  for (auto& shard : jwtCache) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.tokens.clear();
+  }
+}
+
+bool findCachedClaims(const std::string& token, JwtClaims& claims) {
+  JwtCacheShard& shard = jwtCacheShardOf(token);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.tokens.find(token);
+  if (it == shard.tokens.end()) return false;
+  if (std::chrono::system_clock::now() >= it->second.expiresAt) {
+    shard.tokens.erase(it);
+    return false;
+  }
+  claims = it->second;
+  return true;
+}
+
+void cacheClaims(const std::string& token, const JwtClaims& claims) {
+  JwtCacheShard& shard = jwtCacheShardOf(token);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  if (shard.tokens.size() >= jwtCacheShardCapacity) {
+    auto now = std::chrono::system_clock::now();
+    for (auto it = shard.tokens.begin(); it != shard.tokens.end();) {
+      it = now >= it->second.expiresAt ? shard.tokens.erase(it) : std::next(it);
+    }
+    if (shard.tokens.size() >= jwtCacheShardCapacity) {
+      shard.tokens.erase(shard.tokens.begin());
+    }
+  }
+  shard.tokens[token] = claims;
+}
+
+// HMAC-SHA256 with the key already absorbed into the inner and outer digest
+// states, signing copies them instead of keying HMAC again for every token
+struct JwtSigner {
+  EVP_MD_CTX* inner = nullptr;
+  EVP_MD_CTX* outer = nullptr;
+
+  ~JwtSigner() {
+    EVP_MD_CTX_free(inner);
+    EVP_MD_CTX_free(outer);
+  }
+};
+
+std::unique_ptr<JwtSigner> jwtSigner;
+
+// base64url of {"alg":"HS256"}, the header jwt-cpp writes for hs256
+const std::string jwtHeader = "eyJhbGciOiJIUzI1NiJ9";
+constexpr size_t sha256BlockSize = 64;
+constexpr size_t sha256Size = 32;
+
+std::unique_ptr<JwtSigner> createJwtSigner(const std::string& key) {
+  unsigned char block[sha256BlockSize] = {};
+  if (key.size() > sha256BlockSize) {
+    unsigned int length = 0;
+    if (EVP_Digest(key.data(), key.size(), block, &length, EVP_sha256(), nullptr) != 1) {
+      throw std::runtime_error("Failed to hash JWT key");
+    }
+  } else {
+    std::memcpy(block, key.data(), key.size());
+  }
+  unsigned char innerPad[sha256BlockSize];
+  unsigned char outerPad[sha256BlockSize];
+  for (size_t i = 0; i < sha256BlockSize; i++) {
+    innerPad[i] = block[i] ^ 0x36;
+    outerPad[i] = block[i] ^ 0x5c;
+  }
+  OPENSSL_cleanse(block, sizeof(block));
+
+  auto signer = std::make_unique<JwtSigner>();
+  signer->inner = EVP_MD_CTX_new();
+  signer->outer = EVP_MD_CTX_new();
+  bool ok = signer->inner && signer->outer &&
+    EVP_DigestInit_ex(signer->inner, EVP_sha256(), nullptr) == 1 &&
+    EVP_DigestUpdate(signer->inner, innerPad, sizeof(innerPad)) == 1 &&
+    EVP_DigestInit_ex(signer->outer, EVP_sha256(), nullptr) == 1 &&
+    EVP_DigestUpdate(signer->outer, outerPad, sizeof(outerPad)) == 1;
+  OPENSSL_cleanse(innerPad, sizeof(innerPad));
+  OPENSSL_cleanse(outerPad, sizeof(outerPad));
+  if (!ok) {
+    throw std::runtime_error("Failed to prepare JWT signing key");
+  }
+  return signer;
+}
+
+void signHs256(const JwtSigner& signer, const char* data, size_t size, unsigned char* mac) {
+  thread_local std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  unsigned char innerHash[sha256Size];
+  unsigned int length = 0;
+  bool ok = context &&
+    EVP_MD_CTX_copy_ex(context.get(), signer.inner) == 1 &&
+    EVP_DigestUpdate(context.get(), data, size) == 1 &&
+    EVP_DigestFinal_ex(context.get(), innerHash, &length) == 1 &&
+    EVP_MD_CTX_copy_ex(context.get(), signer.outer) == 1 &&
+    EVP_DigestUpdate(context.get(), innerHash, sizeof(innerHash)) == 1 &&
+    EVP_DigestFinal_ex(context.get(), mac, &length) == 1;
+  if (!ok) {
+    throw std::runtime_error("Failed to sign JWT");
+  }
+}
+
+// unpadded, as jwt-cpp encodes every part of the token
+void appendBase64Url(std::string& out, const unsigned char* data, size_t size) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  size_t offset = out.size();
+  out.resize(offset + (size * 4 + 2) / 3);
+  char* output = &out[offset];
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    uint32_t bits = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+    *output++ = alphabet[bits >> 18];
+    *output++ = alphabet[bits >> 12 & 63];
+    *output++ = alphabet[bits >> 6 & 63];
+    *output++ = alphabet[bits & 63];
+  }
+  if (size - i == 1) {
+    uint32_t bits = data[i] << 16;
+    *output++ = alphabet[bits >> 18];
+    *output++ = alphabet[bits >> 12 & 63];
+  } else if (size - i == 2) {
+    uint32_t bits = data[i] << 16 | data[i + 1] << 8;
+    *output++ = alphabet[bits >> 18];
+    *output++ = alphabet[bits >> 12 & 63];
+    *output++ = alphabet[bits >> 6 & 63];
+  }
+}
+
+// escaped the way picojson serializes strings, '/' included
+void appendJwtString(std::string& out, const std::string& value) {
+  static const char hex[] = "0123456789abcdef";
+  out.push_back('"');
+  for (char c : value) {
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '/': out += "\\/"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+          out += "\\u00";
+          out.push_back(hex[(c >> 4) & 15]);
+          out.push_back(hex[c & 15]);
+        } else {
+          out.push_back(c);
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+void appendJwtNumber(std::string& out, int64_t value) {
+  char buffer[24];
+  auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+  out.append(buffer, result.ptr);
+}
 
 void setJwtKey(const std::string& key) {
   jwtKey = key;
+  const char* issuer = std::getenv("JWT_ISSUER");
+  jwtIssuer = issuer ? issuer : "";
+  jwtSigner = createJwtSigner(jwtKey);
+  jwtVerifier = std::make_unique<JwtVerifier>(
+    jwt::verify()
+      .allow_algorithm(jwt::algorithm::hs256(jwtKey))
+      .with_issuer(jwtIssuer)
+  );
+  clearJwtCache();
 }
 
-std::string createJwt(const std::string& ip, const std::string& username, int duration) {
-  auto now = std::chrono::system_clock::now();
-  auto expiresAt = now + std::chrono::seconds(duration);
+// claims are written in the order picojson's sorted object map gives them
+std::string signJwt(const std::string& ip, const std::string& username, const std::string& jti, std::chrono::system_clock::time_point issuedAt, int duration) {
+  if (!jwtSigner) {
+    throw std::runtime_error("JWT key not set");
+  }
+  int64_t iat = std::chrono::duration_cast<std::chrono::seconds>(issuedAt.time_since_epoch()).count();
+
+  thread_local std::string claims;
+  claims.clear();
+  claims += "{\"exp\":";
+  appendJwtNumber(claims, iat + duration);
+  claims += ",\"iat\":";
+  appendJwtNumber(claims, iat);
+  claims += ",\"ip\":";
+  appendJwtString(claims, ip);
+  claims += ",\"iss\":";
+  appendJwtString(claims, jwtIssuer);
+  claims += ",\"jti\":";
+  appendJwtString(claims, jti);
+  claims += ",\"nbf\":";
+  appendJwtNumber(claims, iat);
+  claims += ",\"username\":";
+  appendJwtString(claims, username);
+  claims.push_back('}');
+
+  std::string token;
+  token.reserve(jwtHeader.size() + (claims.size() * 4 + 2) / 3 + (sha256Size * 4 + 2) / 3 + 2);
+  token += jwtHeader;
+  token.push_back('.');
+  appendBase64Url(token, reinterpret_cast<const unsigned char*>(claims.data()), claims.size());
+
+  unsigned char mac[sha256Size];
+  signHs256(*jwtSigner, token.data(), token.size(), mac);
+  token.push_back('.');
+  appendBase64Url(token, mac, sizeof(mac));
+  return token;
+}
+
+std::string signJwtWithBuilder(const std::string& ip, const std::string& username, const std::string& jti, std::chrono::system_clock::time_point issuedAt, int duration) {
+  auto expiresAt = issuedAt + std::chrono::seconds(duration);
 
   std::string token = jwt::create()
-    .set_issued_at(now)
-    .set_not_before(now)
+    .set_issued_at(issuedAt)
+    .set_not_before(issuedAt)
     .set_expires_at(expiresAt)
     .set_payload_claim("ip", jwt::claim(ip))
     .set_payload_claim("username", jwt::claim(username))
-    .set_issuer(std::getenv("JWT_ISSUER"))
+    .set_issuer(jwtIssuer)
+    .set_id(jti)
     .sign(jwt::algorithm::hs256{jwtKey});
 
   return token;
 }
 
-bool isJwtValid(const std::string& token) {
-  if (jwtKey.empty()) {
+// 128 random bits, the handle a token is revoked by
+std::string createTokenId() {
+  unsigned char bytes[16];
+  if (RAND_bytes(bytes, sizeof(bytes)) != 1) {
+    throw std::runtime_error("Failed to generate random bytes");
+  }
+  std::string id;
+  appendBase64Url(id, bytes, sizeof(bytes));
+  return id;
+}
+
+std::string createJwt(const std::string& ip, const std::string& username, int duration) {
+  return signJwt(ip, username, createTokenId(), std::chrono::system_clock::now(), duration);
+}
+
+bool verifyJwt(const std::string& token, JwtClaims& claims) {
+  if (jwtKey.empty() || !jwtVerifier) {
     std::cerr << "[JWT] JWT Key is empty\n";
     return false;
   }
+  bool cached = findCachedClaims(token, claims);
+  recordCacheLookup(CacheKind::JWT, cached);
+  if (cached) return !isRevoked(claims.jti);
+
   try {
     auto decoded = jwt::decode(token);
-
-    auto verifier = jwt::verify()
-      .allow_algorithm(jwt::algorithm::hs256(jwtKey))
-      .with_issuer(std::getenv("JWT_ISSUER"));
-    verifier.verify(decoded);
-    return true;
+    jwtVerifier->verify(decoded);
+    claims.ip = decoded.get_payload_claim("ip").as_string();
+    claims.username = decoded.get_payload_claim("username").as_string();
+    claims.jti = decoded.has_id() ? decoded.get_id() : "";
+    if (isRevoked(claims.jti)) return false;
+    if (!decoded.has_expires_at()) return true;
+    claims.expiresAt = decoded.get_expires_at();
   } catch (const std::exception& e) {
     std::cerr << "[JWT] Verification error: " << e.what() << "\n";
     return false;
   }
+  cacheClaims(token, claims);
+  return true;
+}
+
+bool isJwtValid(const std::string& token) {
+  JwtClaims claims;
+  return verifyJwt(token, claims);
 }
 
 std::string createJwtKey(std::size_t numBytes) {
@@ -83,6 +353,10 @@ std::string createJwtKey(std::size_t numBytes) {
 }
 
 std::tuple<std::string, std::string> extractHostAndUsername(const std::string& token) {
+  JwtClaims claims;
+  if (findCachedClaims(token, claims)) {
+    return std::make_tuple(claims.ip, claims.username);
+  }
   try {
     auto decoded = jwt::decode(token);
 
@@ -96,7 +370,8 @@ std::tuple<std::string, std::string> extractHostAndUsername(const std::string& t
   }
 }
 
-std::string hashPassword(const std::string& password) {
+// unsalted hex SHA-256, how passwords were stored before scrypt
+std::string legacyPasswordHash(const std::string& password) {
   EVP_MD_CTX* context = EVP_MD_CTX_new();
   if (!context) {
     throw std::runtime_error("Failed to create EVP_MD_CTX");
@@ -128,3 +403,99 @@ std::string hashPassword(const std::string& password) {
   return ss.str();
 }
 
+// $scrypt$ln=<log2 N>,r=<r>,p=<p>$<base64url salt>$<base64url key>
+constexpr uint64_t scryptLogN = 15;
+constexpr uint64_t scryptR = 8;
+constexpr uint64_t scryptP = 1;
+constexpr size_t scryptSaltSize = 16;
+constexpr size_t scryptKeySize = 32;
+constexpr uint64_t scryptMaxMemory = 64 * 1024 * 1024;
+const std::string scryptPrefix = "$scrypt$";
+
+struct ScryptParams {
+  uint64_t logN = scryptLogN;
+  uint64_t r = scryptR;
+  uint64_t p = scryptP;
+  std::string salt;
+  std::string key;
+};
+
+std::string deriveScryptKey(const std::string& password, const ScryptParams& params, size_t size) {
+  std::string key(size, '\0');
+  if (EVP_PBE_scrypt(
+        password.data(), password.size(),
+        reinterpret_cast<const unsigned char*>(params.salt.data()), params.salt.size(),
+        uint64_t(1) << params.logN, params.r, params.p, scryptMaxMemory,
+        reinterpret_cast<unsigned char*>(&key[0]), key.size()) != 1) {
+    throw std::runtime_error("Failed to derive scrypt key");
+  }
+  return key;
+}
+
+bool decodeBase64Url(const std::string& text, std::string& out) {
+  out.clear();
+  uint32_t bits = 0;
+  int count = 0;
+  for (char c : text) {
+    int value;
+    if (c >= 'A' && c <= 'Z') value = c - 'A';
+    else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+    else if (c >= '0' && c <= '9') value = c - '0' + 52;
+    else if (c == '-') value = 62;
+    else if (c == '_') value = 63;
+    else return false;
+    bits = bits << 6 | value;
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out.push_back(static_cast<char>(bits >> count & 0xff));
+    }
+  }
+  return true;
+}
+
+bool parseScryptHash(const std::string& stored, ScryptParams& params) {
+  if (stored.compare(0, scryptPrefix.size(), scryptPrefix) != 0) return false;
+  size_t saltStart = stored.find('$', scryptPrefix.size());
+  if (saltStart == std::string::npos) return false;
+  size_t keyStart = stored.find('$', saltStart + 1);
+  if (keyStart == std::string::npos) return false;
+
+  unsigned long long logN, r, p;
+  std::string settings = stored.substr(scryptPrefix.size(), saltStart - scryptPrefix.size());
+  if (std::sscanf(settings.c_str(), "ln=%llu,r=%llu,p=%llu", &logN, &r, &p) != 3 ||
+      logN < 1 || logN > 24 || r < 1 || p < 1) return false;
+  params.logN = logN;
+  params.r = r;
+  params.p = p;
+  return decodeBase64Url(stored.substr(saltStart + 1, keyStart - saltStart - 1), params.salt) &&
+    decodeBase64Url(stored.substr(keyStart + 1), params.key) && !params.key.empty();
+}
+
+std::string hashPassword(const std::string& password) {
+  ScryptParams params;
+  params.salt.resize(scryptSaltSize);
+  if (RAND_bytes(reinterpret_cast<unsigned char*>(&params.salt[0]), params.salt.size()) != 1) {
+    throw std::runtime_error("Failed to generate salt");
+  }
+  std::string key = deriveScryptKey(password, params, scryptKeySize);
+
+  std::string stored = scryptPrefix + "ln=" + std::to_string(params.logN) + ",r=" + std::to_string(params.r) +
+    ",p=" + std::to_string(params.p) + "$";
+  appendBase64Url(stored, reinterpret_cast<const unsigned char*>(params.salt.data()), params.salt.size());
+  stored.push_back('$');
+  appendBase64Url(stored, reinterpret_cast<const unsigned char*>(key.data()), key.size());
+  return stored;
+}
+
+bool verifyPassword(const std::string& password, const std::string& stored, bool& outdated) {
+  ScryptParams params;
+  if (parseScryptHash(stored, params)) {
+    std::string key = deriveScryptKey(password, params, params.key.size());
+    outdated = params.logN != scryptLogN || params.r != scryptR || params.p != scryptP;
+    return CRYPTO_memcmp(key.data(), params.key.data(), key.size()) == 0;
+  }
+  outdated = true;
+  std::string legacy = legacyPasswordHash(password);
+  return legacy.size() == stored.size() && CRYPTO_memcmp(legacy.data(), stored.data(), legacy.size()) == 0;
+}
@@ -1,15 +1,35 @@
 #ifndef SECURITY_H
 #define SECURITY_H
 
+#include <chrono>
 #include <cstddef>
 #include <string>
+#include <tuple>
+
+struct JwtClaims {
+  std::string ip;
+  std::string username;
+  std::string jti; // empty for tokens issued before revocation existed
+  std::chrono::system_clock::time_point expiresAt;
+};
 
 void setJwtKey(const std::string&);
 std::string createJwt(const std::string&, const std::string&, int);
+// ip, username, jti, issued at, duration in seconds; signJwt renders the claims and
+// signs with precomputed HMAC state, the jwt-cpp builder gives the same bytes
+std::string signJwt(const std::string&, const std::string&, const std::string&, std::chrono::system_clock::time_point, int);
+std::string signJwtWithBuilder(const std::string&, const std::string&, const std::string&, std::chrono::system_clock::time_point, int);
+// verified tokens are cached with their claims until exp, a repeated check skips decoding and the HMAC
+// and only probes the revocation filter
+bool verifyJwt(const std::string&, JwtClaims&);
 bool isJwtValid(const std::string&);
 std::string createJwtKey(std::size_t);
 std::tuple<std::string, std::string> extractHostAndUsername(const std::string&);
 
+// salted scrypt, the parameters are stored with the hash; these are slow on
+// purpose and run on the password hashing pool, not on the request path
 std::string hashPassword(const std::string&);
+// password, stored hash; outdated is set for legacy SHA-256 hashes and old parameters
+bool verifyPassword(const std::string&, const std::string&, bool&);
 
 #endif // SECURITY_H
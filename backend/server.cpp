@@ -1,11 +1,19 @@
 #include "server.h"
 #include "http.h"
 #include "types.h"
+#include "ratelimit.h"
+#include "metrics.h"
+#include "trace.h"
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <memory>
+#include <exception>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -97,7 +105,26 @@ std::string readFromSocket(int socket) {
   return data;
 }
 
+// the connection outlives the accept loop iteration, whoever answers first
+// sends, closes and records the request
+Responder createResponder(int clientFd, int metricsIndex, size_t bytesIn, std::chrono::steady_clock::time_point acceptedAt) {
+  auto answered = std::make_shared<std::atomic<bool>>(false);
+  return [=](const std::string& response) {
+    if (answered->exchange(true)) return;
+    if (send(clientFd, response.c_str(), response.size(), MSG_NOSIGNAL) < 0) {
+      std::cerr << "Failed to send response.\n";
+    }
+    close(clientFd);
+    int status = response.size() > 12 ? std::atoi(response.c_str() + 9) : 0;
+    recordRequest(metricsIndex, status, bytesIn, response.size(), std::chrono::steady_clock::now() - acceptedAt);
+    recordConnectionClosed();
+  };
+}
+
 void serverLoop(const ServerOptions& options) {
+  // rendered once, refused clients cost a lookup and a send
+  const std::string tooManyRequests = createResponse(TOO_MANY_REQUESTS, "text/plain", "too many requests");
+
   while (running) {
     sockaddr_in clientAddr;
     socklen_t clientLen = sizeof(clientAddr);
@@ -113,20 +140,46 @@ void serverLoop(const ServerOptions& options) {
       }
       continue;
     }
+    auto acceptedAt = std::chrono::steady_clock::now();
+    recordConnectionOpened();
+    beginRequestTrace();
 
     char clientIp[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIp, INET_ADDRSTRLEN);
-    // TODO add ip bans (to be fetched from mongo)
+    uint32_t clientAddress = ntohl(clientAddr.sin_addr.s_addr);
+    if (isIpBanned(clientAddress)) {
+      send(clientFd, tooManyRequests.data(), tooManyRequests.size(), MSG_NOSIGNAL);
+      close(clientFd);
+      recordRejectedConnection(Rejection::BANNED);
+      recordConnectionClosed();
+      continue;
+    }
 
-    std::string data = readFromSocket(clientFd);
+    std::string data;
+    {
+      TraceSpan span(TracePhase::READ);
+      data = readFromSocket(clientFd);
+    }
 
     if (data.length() < 0) {
       std::cerr << clientIp << ": Failed to receive data.\n";
       close(clientFd);
+      recordConnectionClosed();
+      continue;
+    }
+    if (!allowRequest(clientAddress, data)) {
+      send(clientFd, tooManyRequests.data(), tooManyRequests.size(), MSG_NOSIGNAL);
+      close(clientFd);
+      recordRejectedConnection(Rejection::RATE_LIMITED);
+      recordConnectionClosed();
       continue;
     }
 
-    HttpObject request = parseRequest(data);
+    HttpObject request;
+    {
+      TraceSpan span(TracePhase::PARSE);
+      request = parseRequest(data);
+    }
     request.ip = clientIp;
     std::cout << request.ip << ": " << request.methodStr << " " << request.path << "\n";
 
@@ -144,32 +197,83 @@ void serverLoop(const ServerOptions& options) {
       printBody(request.body);
     }
 
-    std::istringstream iss(request.path);
-    std::string token;
-    std::getline(iss, token, '/');
     Route* currentRoute = options.routes;
-    while (currentRoute != nullptr && std::getline(iss, token, '/')) {
-      if (options.debug) {
-        std::cout << "Path fragment: \"" << token << "\"\n";
+    {
+      TraceSpan span(TracePhase::ROUTE);
+      std::istringstream iss(request.path);
+      std::string token;
+      std::getline(iss, token, '/');
+      while (currentRoute != nullptr && std::getline(iss, token, '/')) {
+        if (options.debug) {
+          std::cout << "Path fragment: \"" << token << "\"\n";
+        }
+        currentRoute = findRoute(currentRoute->nested, token);
+      }
+    }
+
+    if (currentRoute != nullptr && currentRoute->method == request.method && currentRoute->deferredHandler) {
+      Responder respond = createResponder(clientFd, currentRoute->metricsIndex, data.size(), acceptedAt);
+      {
+        TraceSpan span(TracePhase::HANDLER);
+        try {
+          currentRoute->deferredHandler(request, respond);
+        } catch (const std::exception& e) {
+          std::cerr << "[server.cpp:serverLoop] " << request.methodStr << " " << request.path << ": " << e.what() << "\n";
+          respond(createResponse(INTERNAL_SERVER_ERROR, "text/plain", "internal server error"));
+        }
       }
-      currentRoute = findRoute(currentRoute->nested, token);
+      // traced up to the hand-off, the answer comes from another thread
+      endRequestTrace(request.path, 0);
+      continue;
     }
 
     std::string response;
     if (currentRoute != nullptr && currentRoute->method == request.method) {
-        response = currentRoute->handler(request);
+      auto ifNoneMatch = request.headers.find("If-None-Match");
+      CacheMetadata metadata;
+      if (currentRoute->cacheMetadata && ifNoneMatch != request.headers.end()) {
+        metadata = currentRoute->cacheMetadata(request);
+      }
+      bool notModified = !metadata.etag.empty() && matchesETag(ifNoneMatch->second, metadata.etag);
+      if (!metadata.etag.empty()) {
+        recordCacheLookup(CacheKind::CONDITIONAL, notModified);
+      }
+      if (notModified) {
+        response = createNotModifiedResponse(metadata);
+      } else {
+        TraceSpan span(TracePhase::HANDLER);
+        // a throwing handler must not take the accept loop down with it
+        try {
+          response = currentRoute->handler(request);
+        } catch (const std::exception& e) {
+          std::cerr << "[server.cpp:serverLoop] " << request.methodStr << " " << request.path << ": " << e.what() << "\n";
+          response = createResponse(INTERNAL_SERVER_ERROR, "text/plain", "internal server error");
+        } catch (...) {
+          std::cerr << "[server.cpp:serverLoop] " << request.methodStr << " " << request.path << ": unknown exception\n";
+          response = createResponse(INTERNAL_SERVER_ERROR, "text/plain", "internal server error");
+        }
+      }
     } else {
       Json notFound;
       notFound.type = Json::Type::VALUE;
       notFound.value = "Not Found";
       response = createResponse(NOT_FOUND, notFound);
     }
-    ssize_t bytes_sent = send(clientFd, response.c_str(), response.size(), 0);
-    if (bytes_sent < 0) {
-      std::cerr << "Failed to send response.\n";
+    {
+      TraceSpan span(TracePhase::SEND);
+      ssize_t bytes_sent = send(clientFd, response.c_str(), response.size(), 0);
+      if (bytes_sent < 0) {
+        std::cerr << "Failed to send response.\n";
+      }
     }
 
     close(clientFd);
+    // "HTTP/1.1 200 ..."
+    int status = response.size() > 12 ? std::atoi(response.c_str() + 9) : 0;
+    recordRequest(currentRoute ? currentRoute->metricsIndex : 0, status, data.size(), response.size(),
+      std::chrono::steady_clock::now() - acceptedAt);
+    recordConnectionClosed();
+    endRequestTrace(request.path, status);
   }
   
   close(serverFd);
@@ -0,0 +1,162 @@
+#include "sessions.h"
+#include "daily.h"
+#include "day.h"
+#include "storage.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// guesses are acknowledged from memory, changed sessions are written at most
+// sessionFlushInterval later, which bounds what a crash can lose
+constexpr size_t sessionShardCount = 64;
+constexpr auto sessionFlushInterval = std::chrono::seconds(2);
+
+struct SessionShard {
+  std::mutex mtx;
+  std::unordered_map<std::string, GameSession> sessions;
+  std::unordered_set<std::string> dirty;
+};
+
+std::array<SessionShard, sessionShardCount> sessionShards;
+
+std::mutex sessionWriterMtx;
+std::condition_variable sessionWriterCv;
+std::atomic<bool> sessionWriterRunning(false);
+std::thread sessionWriterThread;
+
+SessionShard& shardOf(const std::string& username) {
+  return sessionShards[std::hash<std::string>{}(username) % sessionShardCount];
+}
+
+void loadSessions(Storage& storage, Day today) {
+  size_t count = 0;
+  for (auto& [username, session] : storage.findSessions(today)) {
+    SessionShard& shard = shardOf(username);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    shard.sessions[username] = std::move(session);
+    count++;
+  }
+  std::cout << "Restored " << count << " sessions\n";
+}
+
+GameProgress recordGuess(const std::string& username, Day day, const std::string& game, const std::string& guess, bool correct) {
+  SessionShard& shard = shardOf(username);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  GameSession& session = shard.sessions[username];
+  if (session.day != day) {
+    session.day = day;
+    session.games.clear();
+  }
+  GameProgress& progress = session.games[game];
+  progress.guesses.push_back(guess);
+  progress.solved = progress.solved || correct;
+  shard.dirty.insert(username);
+  return progress;
+}
+
+bool getSession(const std::string& username, Day day, GameSession& session) {
+  SessionShard& shard = shardOf(username);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  auto it = shard.sessions.find(username);
+  if (it == shard.sessions.end() || it->second.day != day) return false;
+  session = it->second;
+  return true;
+}
+
+// copies of the sessions changed since the last flush
+std::vector<std::pair<std::string, GameSession>> takeDirtySessions() {
+  std::vector<std::pair<std::string, GameSession>> changed;
+  for (auto& shard : sessionShards) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    for (const auto& username : shard.dirty) {
+      auto it = shard.sessions.find(username);
+      if (it != shard.sessions.end()) {
+        changed.emplace_back(username, it->second);
+      }
+    }
+    shard.dirty.clear();
+  }
+  return changed;
+}
+
+void markDirty(const std::vector<std::pair<std::string, GameSession>>& sessions) {
+  for (const auto& [username, session] : sessions) {
+    SessionShard& shard = shardOf(username);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    if (shard.sessions.count(username)) {
+      shard.dirty.insert(username);
+    }
+  }
+}
+
+// sessions of past days are dropped once they have been written
+void expireSessions(Day today) {
+  for (auto& shard : sessionShards) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+      if (it->second.day < today && shard.dirty.find(it->first) == shard.dirty.end()) {
+        it = shard.sessions.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+void sessionWriterLoop(Storage& storage) {
+  Day lastDay = getCurrentDay();
+
+  while (true) {
+    bool running;
+    {
+      std::unique_lock<std::mutex> lock(sessionWriterMtx);
+      sessionWriterCv.wait_for(lock, sessionFlushInterval, [] { return !sessionWriterRunning; });
+      running = sessionWriterRunning;
+    }
+
+    auto changed = takeDirtySessions();
+    if (!changed.empty()) {
+      try {
+        storage.writeSessions(changed);
+      } catch (const std::exception& e) {
+        std::cerr << "[sessions.cpp:sessionWriterLoop] " << changed.size() << " sessions not written: " << e.what() << "\n";
+        if (running) markDirty(changed);
+      }
+    }
+
+    Day today = getCurrentDay();
+    if (today != lastDay) {
+      expireSessions(today);
+      lastDay = today;
+    }
+    if (!running) break;
+  }
+}
+
+void startSessionWriter(Storage& storage) {
+  sessionWriterRunning = true;
+  sessionWriterThread = std::thread(sessionWriterLoop, std::ref(storage));
+}
+
+void stopSessionWriter() {
+  {
+    std::lock_guard<std::mutex> lock(sessionWriterMtx);
+    sessionWriterRunning = false;
+  }
+  sessionWriterCv.notify_all();
+  if (sessionWriterThread.joinable()) {
+    sessionWriterThread.join();
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+#include "day.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct GameProgress {
+  std::vector<std::string> guesses; // in order, anime or character ids depending on the game
+  bool solved = false;
+};
+
+struct GameSession {
+  Day day;
+  std::map<std::string, GameProgress> games; // "anime", "character", "screenshot"
+};
+
+// progress of the current day per username, kept in memory and snapshotted
+// to storage by a background writer
+class Storage;
+
+void loadSessions(Storage&, Day);
+
+GameProgress recordGuess(const std::string&, Day, const std::string&, const std::string&, bool);
+bool getSession(const std::string&, Day, GameSession&);
+
+void startSessionWriter(Storage&);
+// flushes every pending change before returning
+void stopSessionWriter();
+
+#endif // SESSIONS_H
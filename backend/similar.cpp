@@ -0,0 +1,123 @@
+#include "similar.h"
+#include "catalog.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+constexpr int sharedGenreScore = 2;
+constexpr int sameEraScore = 3;
+constexpr int eraYears = 5;
+
+// postings per genre and per era, rebuilt whenever the catalog changed since the last lookup
+struct SimilarityIndex {
+  uint64_t version = UINT64_MAX;
+  std::vector<AnimeFeatures> features;
+  std::vector<int> popularity;
+  std::vector<std::vector<uint32_t>> genres{ maxGenreId };
+  std::map<int, std::vector<uint32_t>> eras;
+};
+
+std::shared_mutex similarMtx;
+SimilarityIndex similarIndex;
+// one rebuild at a time, so a slow rebuild cannot install an older catalog
+// over a newer one
+std::mutex similarRebuildMtx;
+
+int eraOf(const AnimeFeatures& features) {
+  return features.year ? features.year / eraYears : -1;
+}
+
+void rebuildSimilarityIndex() {
+  std::lock_guard<std::mutex> rebuildLock(similarRebuildMtx);
+  // another caller may have rebuilt while this one waited
+  uint64_t version = catalogVersion();
+  {
+    std::shared_lock<std::shared_mutex> lock(similarMtx);
+    if (similarIndex.version == version) return;
+  }
+
+  SimilarityIndex index;
+  index.version = version;
+  size_t size = catalogSize();
+  index.features.resize(size);
+  index.popularity.resize(size);
+  for (uint32_t i = 0; i < size; i++) {
+    auto entry = getCatalogEntry(i);
+    if (!entry) continue;
+    index.features[i] = entry->features;
+    index.popularity[i] = entry->popularity;
+    for (unsigned genre = 0; genre < maxGenreId; genre++) {
+      if (entry->features.genres[genre / 64] >> (genre % 64) & 1) {
+        index.genres[genre].push_back(i);
+      }
+    }
+    int era = eraOf(entry->features);
+    if (era >= 0) {
+      index.eras[era].push_back(i);
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(similarMtx);
+  similarIndex = std::move(index);
+}
+
+std::vector<uint32_t> findSimilarAnime(uint32_t target, size_t count) {
+  uint64_t version = catalogVersion();
+  {
+    std::shared_lock<std::shared_mutex> lock(similarMtx);
+    if (similarIndex.version != version) {
+      lock.unlock();
+      rebuildSimilarityIndex();
+    }
+  }
+
+  std::shared_lock<std::shared_mutex> lock(similarMtx);
+  if (target >= similarIndex.features.size()) return {};
+  const AnimeFeatures& features = similarIndex.features[target];
+
+  std::unordered_map<uint32_t, int> scores;
+  for (unsigned genre = 0; genre < maxGenreId; genre++) {
+    if (!(features.genres[genre / 64] >> (genre % 64) & 1)) continue;
+    for (uint32_t candidate : similarIndex.genres[genre]) {
+      scores[candidate] += sharedGenreScore;
+    }
+  }
+  auto era = similarIndex.eras.find(eraOf(features));
+  if (era != similarIndex.eras.end()) {
+    for (uint32_t candidate : era->second) {
+      scores[candidate] += sameEraScore;
+    }
+  }
+  scores.erase(target);
+
+  std::vector<std::pair<int, uint32_t>> ranked;
+  ranked.reserve(scores.size());
+  for (const auto& [candidate, score] : scores) {
+    ranked.emplace_back(score, candidate);
+  }
+  auto moreSimilar = [&](const std::pair<int, uint32_t>& a, const std::pair<int, uint32_t>& b) {
+    if (a.first != b.first) return a.first > b.first;
+    int popularityA = similarIndex.popularity[a.second];
+    int popularityB = similarIndex.popularity[b.second];
+    return popularityA != popularityB ? popularityA < popularityB : a.second < b.second;
+  };
+  if (ranked.size() > count) {
+    std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end(), moreSimilar);
+    ranked.resize(count);
+  } else {
+    std::sort(ranked.begin(), ranked.end(), moreSimilar);
+  }
+
+  std::vector<uint32_t> similar;
+  similar.reserve(ranked.size());
+  for (const auto& [score, candidate] : ranked) {
+    similar.push_back(candidate);
+  }
+  return similar;
+}
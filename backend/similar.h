@@ -0,0 +1,12 @@
+#ifndef SIMILAR_H
+#define SIMILAR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// catalog indexes of anime sharing genres or era with the given one, most
+// similar first, ties broken by popularity
+std::vector<uint32_t> findSimilarAnime(uint32_t, size_t);
+
+#endif // SIMILAR_H
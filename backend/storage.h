@@ -0,0 +1,78 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include "day.h"
+#include "scores.h"
+#include "sessions.h"
+
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/oid.hpp>
+#include <bsoncxx/stdx/optional.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// everything the server persists; one instance is shared by the handlers and
+// the background threads, so implementations are thread safe. Anime and
+// dailies are handed around as the documents stored in mongo.
+class Storage {
+public:
+  virtual ~Storage() = default;
+
+  // password hash of a user
+  virtual bsoncxx::stdx::optional<std::string> findPassword(const std::string&) = 0;
+  // username, password hash; false if the username is taken
+  virtual bool insertUser(const std::string&, const std::string&) = 0;
+  virtual void updatePassword(const std::string&, const std::string&) = 0;
+
+  // jwt signing key, created on first use
+  virtual std::string loadJwtKey() = 0;
+
+  virtual size_t countAnime() = 0;
+  // anime at a position of the natural order, dailies are picked this way
+  virtual bsoncxx::stdx::optional<bsoncxx::document::value> findAnimeAt(size_t) = 0;
+  virtual bsoncxx::stdx::optional<bsoncxx::document::value> findAnime(const bsoncxx::oid&) = 0;
+  virtual std::vector<bsoncxx::document::value> findAnime(const std::vector<bsoncxx::oid>&) = 0;
+  virtual void forEachAnime(const std::function<void(const bsoncxx::document::view&)>&) = 0;
+  // MAL id to the last refresh in unix milliseconds
+  virtual std::unordered_map<int64_t, int64_t> findAnimeUpdates() = 0;
+  // upserts by MAL id, returns the documents as stored
+  virtual std::vector<bsoncxx::document::value> upsertAnime(const std::vector<bsoncxx::document::value>&) = 0;
+
+  virtual bsoncxx::stdx::optional<bsoncxx::document::value> findDaily(Day) = 0;
+  // false if the day already has a daily
+  virtual bool insertDaily(const bsoncxx::document::view&) = 0;
+  // existing dailies between two days (inclusive), oldest first
+  virtual std::vector<bsoncxx::document::value> findDailies(Day, Day) = 0;
+
+  // idempotent on Score::key, a replayed batch never double counts
+  virtual void writeScores(const std::vector<Score>&) = 0;
+  // scores from a day on, oldest day first
+  virtual std::vector<Score> findScores(Day) = 0;
+
+  virtual std::vector<std::pair<std::string, GameSession>> findSessions(Day) = 0;
+  virtual void writeSessions(const std::vector<std::pair<std::string, GameSession>>&) = 0;
+
+  // jti, exp of the token; false if it was already revoked
+  virtual bool insertRevocation(const std::string&, std::chrono::system_clock::time_point) = 0;
+  // revocations whose token has not expired yet
+  virtual std::vector<std::pair<std::string, std::chrono::system_clock::time_point>> findRevocations() = 0;
+
+  // addresses banned right now
+  virtual std::vector<std::string> findBans() = 0;
+};
+
+// uri, database name; creates the collections and indexes it needs
+std::unique_ptr<Storage> createMongoStorage(const std::string&, const std::string&);
+// hash maps and sorted indexes seeded from a JSON lines file of
+// { "collection": name, "document": extended JSON }, nothing is written back
+std::unique_ptr<Storage> createMemoryStorage(const std::string&);
+
+#endif // STORAGE_H
@@ -0,0 +1,93 @@
+#include "text.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// decodes one code point, invalid sequences are passed through byte by byte
+uint32_t decodeUtf8(std::string_view str, size_t& i) {
+  unsigned char c = static_cast<unsigned char>(str[i]);
+  int length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+  if (length <= 1 || i + length > str.size()) {
+    i++;
+    return c;
+  }
+  uint32_t codePoint = c & (0x7F >> length);
+  for (int j = 1; j < length; j++) {
+    unsigned char next = static_cast<unsigned char>(str[i + j]);
+    if ((next & 0xC0) != 0x80) {
+      i++;
+      return c;
+    }
+    codePoint = (codePoint << 6) | (next & 0x3F);
+  }
+  i += length;
+  return codePoint;
+}
+
+void encodeUtf8(uint32_t codePoint, std::string& out) {
+  if (codePoint < 0x80) {
+    out += static_cast<char>(codePoint);
+  } else if (codePoint < 0x800) {
+    out += static_cast<char>(0xC0 | (codePoint >> 6));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    out += static_cast<char>(0xE0 | (codePoint >> 12));
+    out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (codePoint >> 18));
+    out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (codePoint & 0x3F));
+  }
+}
+
+uint32_t foldCodePoint(uint32_t c) {
+  if (c >= 'A' && c <= 'Z') return c + 0x20;
+  if (c < 0x80) return c;
+  // Latin-1
+  if (c >= 0xC0 && c <= 0xDE && c != 0xD7) return c + 0x20;
+  // Latin Extended-A, upper and lower case alternate
+  if ((c >= 0x100 && c <= 0x12F) || (c >= 0x132 && c <= 0x137) || (c >= 0x14A && c <= 0x177)) return c | 1;
+  if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) return (c & 1) ? c + 1 : c;
+  if (c == 0x178) return 0xFF;
+  // Greek
+  if (c >= 0x391 && c <= 0x3A9 && c != 0x3A2) return c + 0x20;
+  if (c == 0x3C2) return 0x3C3;
+  // Cyrillic
+  if (c >= 0x410 && c <= 0x42F) return c + 0x20;
+  if (c >= 0x400 && c <= 0x40F) return c + 0x50;
+  // fullwidth forms fold to ASCII
+  if (c >= 0xFF21 && c <= 0xFF3A) return c - 0xFF21 + 'a';
+  if (c >= 0xFF41 && c <= 0xFF5A) return c - 0xFF41 + 'a';
+  if (c >= 0xFF10 && c <= 0xFF19) return c - 0xFF10 + '0';
+  if (c == 0x3000) return ' ';
+  return c;
+}
+
+std::string foldCase(std::string_view str) {
+  std::string folded;
+  folded.reserve(str.size());
+  bool pendingSpace = false;
+
+  size_t i = 0;
+  while (i < str.size()) {
+    uint32_t c = foldCodePoint(decodeUtf8(str, i));
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      pendingSpace = !folded.empty();
+      continue;
+    }
+    if (pendingSpace) {
+      folded += ' ';
+      pendingSpace = false;
+    }
+    if (c == 0xDF) {
+      folded += "ss";
+    } else {
+      encodeUtf8(c, folded);
+    }
+  }
+
+  return folded;
+}
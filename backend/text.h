@@ -0,0 +1,11 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <string>
+#include <string_view>
+
+// simple Unicode case folding (Latin, Greek, Cyrillic, fullwidth forms) of
+// UTF-8 text, with runs of whitespace collapsed to a single space
+std::string foldCase(std::string_view);
+
+#endif // TEXT_H
@@ -0,0 +1,241 @@
+#include "trace.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+constexpr size_t maxSpansPerRequest = 64;
+constexpr size_t keptRecordsPerThread = 256;
+
+const char* const phaseNames[] = {
+  "read", "parse", "route", "handler", "mongo", "parse_document", "create_response", "send"
+};
+
+struct Span {
+  TracePhase phase;
+  uint8_t depth;
+  uint64_t start;
+  uint64_t end;
+};
+
+struct TraceRecord {
+  uint64_t id;
+  std::string route;
+  int status;
+  uint64_t start;
+  uint64_t end;
+  std::vector<Span> spans;
+};
+
+// finished records worth keeping, the lock is only taken for those and by the export
+struct TraceRing {
+  std::mutex mtx;
+  int threadIndex;
+  std::deque<TraceRecord> records;
+};
+
+struct ActiveTrace {
+  bool active = false;
+  uint64_t start = 0;
+  uint8_t depth = 0;
+  size_t count = 0;
+  std::array<Span, maxSpansPerRequest> spans;
+  std::vector<int> openMongo;
+};
+
+thread_local ActiveTrace activeTrace;
+
+unsigned traceSampleEvery = 1000;
+uint64_t traceSlowTicks = UINT64_MAX;
+std::string chromeTracePath;
+double ticksPerMicro = 1000;
+std::atomic<uint64_t> traceCounter(0);
+
+std::mutex traceRingsMtx;
+std::vector<std::shared_ptr<TraceRing>> traceRings;
+
+// TSC where available, steady_clock nanoseconds otherwise
+uint64_t traceTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void calibrateTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t ticksStart = traceTicks();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t ticksEnd = traceTicks();
+  double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - wallStart).count();
+  ticksPerMicro = (ticksEnd - ticksStart) / micros;
+#endif
+}
+
+double ticksToMicros(uint64_t ticks) {
+  return ticks / ticksPerMicro;
+}
+
+void configureTracing(unsigned sampleEvery, unsigned slowMillis, const std::string& chromePath) {
+  calibrateTicks();
+  traceSampleEvery = sampleEvery;
+  traceSlowTicks = slowMillis ? static_cast<uint64_t>(slowMillis * 1000.0 * ticksPerMicro) : UINT64_MAX;
+  chromeTracePath = chromePath;
+}
+
+TraceRing& localTraceRing() {
+  thread_local std::shared_ptr<TraceRing> ring;
+  if (!ring) {
+    ring = std::make_shared<TraceRing>();
+    std::lock_guard<std::mutex> lock(traceRingsMtx);
+    ring->threadIndex = static_cast<int>(traceRings.size());
+    traceRings.push_back(ring);
+  }
+  return *ring;
+}
+
+int openSpan(TracePhase phase) {
+  ActiveTrace& trace = activeTrace;
+  if (!trace.active || trace.count == maxSpansPerRequest) return -1;
+  int index = static_cast<int>(trace.count++);
+  trace.spans[index] = Span{ phase, trace.depth++, traceTicks(), 0 };
+  return index;
+}
+
+void closeSpan(int index) {
+  if (index < 0 || !activeTrace.active) return;
+  activeTrace.spans[index].end = traceTicks();
+  activeTrace.depth--;
+}
+
+TraceSpan::TraceSpan(TracePhase phase) : index(openSpan(phase)) {}
+
+TraceSpan::~TraceSpan() {
+  closeSpan(index);
+}
+
+void traceMongoStarted() {
+  if (!activeTrace.active) return;
+  activeTrace.openMongo.push_back(openSpan(TracePhase::MONGO));
+}
+
+void traceMongoFinished() {
+  if (!activeTrace.active || activeTrace.openMongo.empty()) return;
+  closeSpan(activeTrace.openMongo.back());
+  activeTrace.openMongo.pop_back();
+}
+
+void beginRequestTrace() {
+  ActiveTrace& trace = activeTrace;
+  trace.active = true;
+  trace.depth = 0;
+  trace.count = 0;
+  trace.openMongo.clear();
+  trace.start = traceTicks();
+}
+
+void printTraceRecord(const TraceRecord& record, bool slow) {
+  std::string line = "[trace] {\"id\":" + std::to_string(record.id) + ",\"route\":\"" + record.route +
+    "\",\"status\":" + std::to_string(record.status) + ",\"slow\":" + (slow ? "true" : "false");
+  char number[32];
+  std::snprintf(number, sizeof(number), "%.1f", ticksToMicros(record.end - record.start));
+  line += ",\"total_us\":" + std::string(number) + ",\"spans\":[";
+  for (size_t i = 0; i < record.spans.size(); i++) {
+    const Span& span = record.spans[i];
+    if (i) line += ",";
+    line += "{\"phase\":\"" + std::string(phaseNames[static_cast<int>(span.phase)]) + "\",\"depth\":" + std::to_string(span.depth);
+    std::snprintf(number, sizeof(number), "%.1f", ticksToMicros(span.start - record.start));
+    line += ",\"start_us\":" + std::string(number);
+    std::snprintf(number, sizeof(number), "%.1f", ticksToMicros(span.end - span.start));
+    line += ",\"dur_us\":" + std::string(number) + "}";
+  }
+  line += "]}\n";
+  std::cout << line;
+}
+
+void endRequestTrace(const std::string& route, int status) {
+  ActiveTrace& trace = activeTrace;
+  if (!trace.active) return;
+  trace.active = false;
+  uint64_t end = traceTicks();
+  uint64_t id = ++traceCounter;
+  bool slow = end - trace.start >= traceSlowTicks;
+  bool sampled = traceSampleEvery && id % traceSampleEvery == 0;
+  if (!slow && !sampled) return;
+
+  // the path comes from the client and ends up inside JSON
+  std::string label = route;
+  for (char& c : label) {
+    if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20) c = '_';
+  }
+  TraceRecord record{ id, label, status, trace.start, end, {} };
+  record.spans.reserve(trace.count);
+  for (size_t i = 0; i < trace.count; i++) {
+    Span span = trace.spans[i];
+    // a span left open by an exception ends with the request
+    if (span.end == 0) span.end = end;
+    record.spans.push_back(span);
+  }
+  printTraceRecord(record, slow);
+
+  TraceRing& ring = localTraceRing();
+  std::lock_guard<std::mutex> lock(ring.mtx);
+  if (ring.records.size() == keptRecordsPerThread) {
+    ring.records.pop_front();
+  }
+  ring.records.push_back(std::move(record));
+}
+
+void appendChromeEvent(std::string& out, const char* name, int threadIndex, double start, double duration, const TraceRecord& record) {
+  char buffer[160];
+  std::snprintf(buffer, sizeof(buffer),
+    "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,",
+    name, threadIndex, start, duration);
+  if (out.back() != '[') out += ",\n";
+  out += buffer;
+  out += "\"args\":{\"id\":" + std::to_string(record.id) + ",\"route\":\"" + record.route +
+    "\",\"status\":" + std::to_string(record.status) + "}}";
+}
+
+void writeChromeTrace() {
+  if (chromeTracePath.empty()) return;
+
+  std::vector<std::shared_ptr<TraceRing>> rings;
+  {
+    std::lock_guard<std::mutex> lock(traceRingsMtx);
+    rings = traceRings;
+  }
+
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (const auto& ring : rings) {
+    std::lock_guard<std::mutex> lock(ring->mtx);
+    for (const auto& record : ring->records) {
+      appendChromeEvent(out, "request", ring->threadIndex, ticksToMicros(record.start),
+        ticksToMicros(record.end - record.start), record);
+      for (const auto& span : record.spans) {
+        appendChromeEvent(out, phaseNames[static_cast<int>(span.phase)], ring->threadIndex,
+          ticksToMicros(span.start), ticksToMicros(span.end - span.start), record);
+      }
+    }
+  }
+  out += "]}\n";
+
+  std::ofstream file(chromeTracePath, std::ios::trunc);
+  if (!file.write(out.data(), out.size())) {
+    std::cerr << "[trace.cpp:writeChromeTrace] failed to write " << chromeTracePath << "\n";
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class TracePhase {
+  READ,
+  PARSE,
+  ROUTE,
+  HANDLER,
+  MONGO,
+  PARSE_DOCUMENT,
+  CREATE_RESPONSE,
+  SEND
+};
+
+// every request on the server thread is traced into a thread_local record,
+// spans cost two TSC reads; the record is kept and printed only when the
+// request was sampled or slower than the threshold
+
+// sample one request in N (0 never), slow threshold in milliseconds, file the
+// Chrome trace-event JSON is written to by writeChromeTrace (empty for none)
+void configureTracing(unsigned, unsigned, const std::string&);
+
+void beginRequestTrace();
+// route path, status
+void endRequestTrace(const std::string&, int);
+
+// phases of the request being traced on this thread, no-ops when none is
+class TraceSpan {
+private:
+  int index;
+
+public:
+  explicit TraceSpan(TracePhase);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+// mongo commands are bracketed by the driver's APM callbacks
+void traceMongoStarted();
+void traceMongoFinished();
+
+// kept records of every thread, loadable in chrome://tracing or Perfetto
+void writeChromeTrace();
+
+#endif // TRACE_H
@@ -33,6 +33,7 @@ struct Json {
 
 struct HttpObject {
   std::string ip;
+  int status = 0; // responses only
   Method method;
   std::string methodStr;
   std::string path;
@@ -41,12 +42,24 @@ struct HttpObject {
   Json body;
 };
 
+struct CacheMetadata {
+  std::string etag; // quoted, empty if the response has no validator
+  std::string lastModified;
+  std::string cacheControl;
+};
+
+// sends a rendered response and closes the connection; callable once, from any thread
+using Responder = std::function<void(const std::string&)>;
+
 struct Route {
   Route* next = nullptr;
   Route* nested = nullptr;
   std::string path = "";
   Method method = Method::NONE;
   std::function<std::string(const HttpObject&)> handler = nullptr; // query params, and body
+  std::function<CacheMetadata(const HttpObject&)> cacheMetadata = nullptr; // checked against If-None-Match before the handler
+  std::function<void(const HttpObject&, Responder)> deferredHandler = nullptr; // used instead of handler, answers once its work is done elsewhere
+  int metricsIndex = 0; // assigned by registerRouteMetrics
 }; 
 
 struct ServerOptions {
@@ -57,12 +70,16 @@ struct ServerOptions {
 
 enum ResponseStatus {
   OK = 200,
+  ACCEPTED = 202,
+  NOT_MODIFIED = 304,
   BAD_REQUEST = 400,
   UNAUTHORIZED = 401,
   FORBIDDEN = 403,
   NOT_FOUND = 404,
   CONFLICT = 409,
-  INTERNAL_SERVER_ERROR = 500
+  TOO_MANY_REQUESTS = 429,
+  INTERNAL_SERVER_ERROR = 500,
+  SERVICE_UNAVAILABLE = 503
 };
 
 #endif // TYPE_H